@@ -8,6 +8,8 @@
 #include <ios>
 #include <stdexcept>
 #include <cctype>
+#include <cerrno>
+#include <algorithm>
 
 #ifdef WIN32
 #include <io.h>
@@ -21,20 +23,215 @@
 #define SHARE_MODE_READ_ONLY _SH_DENYNO
 #define __fopen(name, mode, sharedMode) _fsopen(name, mode, sharedMode)
 #else
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #define __fseek64 fseeko
 #define __ftell64 ftello
-#define SHARED_MODE_EXCLUSIVE 0
-#define SHARED_MODE_WRITING_SHARED_READ 0
-#define SHARED_MODE_READ_ONLY 0
-#define __fopen(name, mode, sharedMode) fopen(name, mode)
+
+// Same meaning as the Windows share modes, emulated with advisory locks (see fdsharelock).
+#define SHARE_MODE_EXCLUSIVE 0x10
+#define SHARE_MODE_WRITING_SHARE_READ 0x20
+#define SHARE_MODE_READ_ONLY 0x40
+#define __fopen(name, mode, sharedMode) fsopen2(name, mode, sharedMode)
 #endif
 
+// Old spellings, kept for existing callers
+#define SHARED_MODE_EXCLUSIVE SHARE_MODE_EXCLUSIVE
+#define SHARED_MODE_WRITING_SHARED_READ SHARE_MODE_WRITING_SHARE_READ
+#define SHARED_MODE_READ_ONLY SHARE_MODE_READ_ONLY
+
 namespace jfio {
 
 // This file contains "throwy" versions of the
 // good old fopen, fseek, etc. functions.
 
+#ifndef WIN32
+// Share modes are emulated with two lock bytes far past any real data:
+// every opener holds a read lock on the reader byte or a write lock on
+// the writer byte (or both), and conflicting locks fail the open.
+//   SHARE_MODE_EXCLUSIVE:          write lock on both bytes
+//   SHARE_MODE_WRITING_SHARE_READ: write lock on the writer byte
+//   SHARE_MODE_READ_ONLY:          read lock on the reader byte
+// The locks are advisory, so only jfio (or anything following
+// the same protocol) is kept out.
+constexpr int64_t kShareLockReaderByte = INT64_MAX - 2;
+constexpr int64_t kShareLockWriterByte = INT64_MAX - 1;
+
+static inline bool fdlockrange(int fileNum, short type, int64_t start, int64_t n) {
+  struct flock lock {};
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = start;
+  lock.l_len = n;
+
+  // Open file description locks belong to the descriptor, not the process:
+  // they conflict between two opens in the same process (like Windows sharing),
+  // and closing some other descriptor of the file does not drop them.
+  #ifdef F_OFD_SETLK
+  return fcntl(fileNum, F_OFD_SETLK, &lock) == 0;
+  #else
+  return fcntl(fileNum, F_SETLK, &lock) == 0;
+  #endif
+}
+
+/**
+ * Returns true if some other descriptor holds a lock that conflicts
+ * with a lock of the given type on [start, start + n).
+ */
+static inline bool fdislocked(int fileNum, short type, int64_t start, int64_t n) {
+  struct flock lock {};
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = start;
+  lock.l_len = n;
+
+  #ifdef F_OFD_GETLK
+  const auto result = fcntl(fileNum, F_OFD_GETLK, &lock);
+  #else
+  const auto result = fcntl(fileNum, F_GETLK, &lock);
+  #endif
+
+  return result == 0 && lock.l_type != F_UNLCK;
+}
+
+/**
+ * Takes the locks of the share mode without blocking.
+ * Returns false if another open of the file does not allow it (errno is EAGAIN
+ * or EACCES), or if locking failed (any other errno).
+ */
+static inline bool fdsharelock(int fileNum, int shareMode) {
+  const auto flags = fcntl(fileNum, F_GETFL);
+  if (flags < 0) {
+    return false;
+  }
+
+  const auto access = flags & O_ACCMODE;
+
+  switch (shareMode) {
+  case SHARE_MODE_EXCLUSIVE:
+  case SHARE_MODE_WRITING_SHARE_READ: {
+    const auto start = shareMode == SHARE_MODE_EXCLUSIVE ? kShareLockReaderByte : kShareLockWriterByte;
+    const int64_t n = shareMode == SHARE_MODE_EXCLUSIVE ? 2 : 1;
+    if (access != O_RDONLY) {
+      return fdlockrange(fileNum, F_WRLCK, start, n);
+    }
+
+    // Write locks need write access (see fdopen2), which a read-only file does not give.
+    // Check for conflicts instead, and hold read locks so no other writer can start.
+    if (fdislocked(fileNum, F_WRLCK, start, n)) {
+      errno = EAGAIN;
+      return false;
+    }
+
+    return fdlockrange(fileNum, F_RDLCK, start, n);
+  }
+  default:
+    if (access != O_WRONLY) {
+      return fdlockrange(fileNum, F_RDLCK, kShareLockReaderByte, 1);
+    }
+
+    // Read locks need read access: only check that no exclusive open holds the file
+    if (fdislocked(fileNum, F_RDLCK, kShareLockReaderByte, 1)) {
+      errno = EAGAIN;
+      return false;
+    }
+
+    return true;
+  }
+}
+
+/**
+ * Maps fopen style modes to open flags.
+ * "a" does not use O_APPEND, since jfio always writes at explicit positions.
+ */
+static inline int fopenflags(const std::string& mode) {
+  const bool update = mode.find('+') != std::string::npos;
+  int flags = O_CLOEXEC;
+
+  switch (mode.empty() ? 'r' : mode[0]) {
+  case 'w':
+    flags |= (update ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+    break;
+  case 'a':
+    flags |= (update ? O_RDWR : O_WRONLY) | O_CREAT;
+    break;
+  default:
+    flags |= update ? O_RDWR : O_RDONLY;
+    break;
+  }
+
+  if (mode.find('x') != std::string::npos) {
+    flags |= O_EXCL;
+  }
+
+  return flags;
+}
+
+/**
+ * Opens a file descriptor and takes the share mode locks.
+ * "w" modes only truncate once the locks are held, so a conflicting
+ * open never wipes the file under its current owner.
+ * Returns -1 if the file cannot be opened.
+ * Throws a runtime_error if the file is locked by another open.
+ */
+static inline int fdopen2(const char* name, const std::string& mode, int shareMode) {
+  const auto flags = fopenflags(mode);
+  const auto access = flags & O_ACCMODE;
+
+  // The share mode locks need a descriptor that can take them: write locks need
+  // write access, read locks need read access. Ask for both when the mode
+  // does not give the one needed. jfio only uses the access the mode asks for.
+  const bool writeLock = shareMode != SHARE_MODE_READ_ONLY;
+  int fileNum = -1;
+  if ((writeLock && access == O_RDONLY) || (!writeLock && access == O_WRONLY)) {
+    fileNum = ::open(name, (flags & ~O_ACCMODE & ~O_TRUNC) | O_RDWR, 0666);
+  }
+
+  if (fileNum < 0) {
+    fileNum = ::open(name, flags & ~O_TRUNC, 0666);
+  }
+
+  if (fileNum < 0) {
+    return -1;
+  }
+
+  if (!fdsharelock(fileNum, shareMode)) {
+    const auto error = errno;
+    ::close(fileNum);
+    if (error == EAGAIN || error == EACCES) {
+      throw std::runtime_error(std::string("Cannot open file ") + name + ": it is in use by another process");
+    }
+
+    throw std::runtime_error(std::string("Cannot lock file ") + name + ". Error code: " + std::to_string(error));
+  }
+
+  if ((flags & O_TRUNC) != 0 && ftruncate(fileNum, 0) != 0) {
+    ::close(fileNum);
+    return -1;
+  }
+
+  return fileNum;
+}
+
+/**
+ * fopen with a share mode, like _fsopen on Windows.
+ */
+static inline std::FILE* fsopen2(const char* name, const char* mode, int shareMode) {
+  const int fileNum = fdopen2(name, mode, shareMode);
+  if (fileNum < 0) {
+    return nullptr;
+  }
+
+  std::FILE* f = fdopen(fileNum, mode);
+  if (f == nullptr) {
+    ::close(fileNum);
+  }
+
+  return f;
+}
+#endif
+
 /**
  * Try opening the file in mode A.
  * If mode A fails, then will try again in mode B (only if A != B).
@@ -228,4 +425,97 @@ static inline void fsync2(std::FILE* f) {
 }
 }
 
+/**
+ * Truncates (or extends) the file to exactly size bytes.
+ * Buffered writes are flushed before the file is resized.
+ */
+static inline void ftruncate2(std::FILE* f, int64_t size) {
+  fflush2(f);
+
+  #ifdef WIN32
+  const auto truncateResult = _chsize_s(_fileno(f), size) == 0;
+  #else
+  const auto truncateResult = ftruncate(fileno(f), size) == 0;
+  #endif
+
+  if (!truncateResult) {
+    throw std::runtime_error("Fail to truncate file");
+  }
+}
+
+#ifdef __linux__
+/**
+ * Copies up to n bytes between two file descriptors with copy_file_range,
+ * so the bytes never leave the kernel. The positions and n are advanced.
+ * Stops early (with n > 0) if the file system does not support the call,
+ * in which case the caller has to finish the copy some other way.
+ */
+static inline void fdcopyrange(int srcNum, int64_t& srcPos, int dstNum, int64_t& dstPos, int64_t& n) {
+  off_t srcOffset = srcPos;
+  off_t dstOffset = dstPos;
+
+  while (n > 0) {
+    const auto copied = copy_file_range(srcNum, &srcOffset, dstNum, &dstOffset, size_t(n), 0);
+    if (copied < 0) {
+      if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+        break;
+      }
+
+      throw std::runtime_error("copy_file_range failed. Error code: " + std::to_string(errno));
+    }
+
+    if (copied == 0) {
+      throw std::runtime_error("Unexpected EOF while copying file range");
+    }
+
+    n -= copied;
+  }
+
+  srcPos = srcOffset;
+  dstPos = dstOffset;
+}
+#endif
+
+/**
+ * Copies n bytes from src (starting at srcPos) to dst (starting at dstPos).
+ * On Linux this uses copy_file_range so the bytes never leave the kernel.
+ * Other platforms, or file systems that refuse the call, get a buffered copy.
+ * When src and dst are the same file, the two ranges must not overlap.
+ */
+static inline void fcopyrange2(
+  std::FILE* src,
+  int64_t srcPos,
+  std::FILE* dst,
+  int64_t dstPos,
+  int64_t n
+) {
+  fflush2(src);
+  fflush2(dst);
+
+  #ifdef __linux__
+  fdcopyrange(fileno(src), srcPos, fileno(dst), dstPos, n);
+  #endif
+
+  char buff[64 * 1024];
+  while (n > 0) {
+    const auto chunk = std::min<int64_t>(n, sizeof(buff));
+
+    fseek2(src, srcPos, SEEK_SET);
+    if (std::fread(buff, 1, size_t(chunk), src) != size_t(chunk)) {
+      throw std::runtime_error("Unexpected EOF while copying file range");
+    }
+
+    fseek2(dst, dstPos, SEEK_SET);
+    if (std::fwrite(buff, 1, size_t(chunk), dst) != size_t(chunk)) {
+      throw std::runtime_error("Write failed. Error code: " + std::to_string(ferror(dst)));
+    }
+
+    srcPos += chunk;
+    dstPos += chunk;
+    n -= chunk;
+  }
+
+  fflush2(dst);
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,580 @@
+#pragma once
+
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "file2.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+namespace jfio {
+
+// Storage backends used by BasicJFile for both the main file and the journal.
+//
+// Every backend provides:
+//   static B open(path, modeA, modeB, shareMode)  (same fallback rules as fopen2)
+//   static bool isEmpty(path)  (true if the file is missing or has no bytes)
+//   bool isOpen() const
+//   void close()
+//   uint64_t read(int64_t pos, void* buff, uint64_t n)  (short read at EOF)
+//   void write(int64_t pos, const void* buff, uint64_t n)
+//   void sync()  (flush buffers, then make the data durable)
+//   int64_t size()
+//   void truncate(int64_t size)
+//   void preallocate(int64_t size)  (hint only, never changes the size)
+//   void readahead(int64_t pos, int64_t n)  (hint that [pos, pos + n) is read soon)
+//   void copyRange(int64_t dstPos, B& src, int64_t srcPos, int64_t n)
+//   void discardCache()  (drop read buffers, the file was changed by another process)
+//   static constexpr bool kShared  (whether other processes can open the same file)
+//
+// On POSIX systems, the stdio and fd backends take the share mode locks
+// (see fdsharelock) when opening a file.
+//
+// The jf* functions are templates over the backend, so all of these calls
+// are resolved at compile time and can be inlined.
+
+#if defined(__linux__)
+static inline void fdpreallocate(int fileNum, int64_t size) {
+  if (fallocate(fileNum, FALLOC_FL_KEEP_SIZE, 0, size) != 0 &&
+    errno != EOPNOTSUPP && errno != ENOSYS) {
+    throw std::runtime_error("fallocate failed. Error code: " + std::to_string(errno));
+  }
+}
+#else
+static inline void fdpreallocate(int, int64_t) {
+}
+#endif
+
+#ifndef WIN32
+static inline void fdreadahead(int fileNum, int64_t pos, int64_t n) {
+  // Only a hint, failures don't matter
+  posix_fadvise(fileNum, pos, n, POSIX_FADV_WILLNEED);
+}
+#endif
+
+static inline bool diskFileIsEmpty(const std::filesystem::path& path) {
+  std::error_code error;
+  const auto size = std::filesystem::file_size(path, error);
+  return error || size == 0;
+}
+
+/**
+ * The original std::FILE* based storage.
+ * Keeps track of the stream position, so sequential
+ * reads and writes don't pay for a seek every call.
+ */
+struct StdioBackend {
+  static constexpr bool kShared = true;
+
+  std::FILE* f = nullptr;
+
+  // Position of the stream, or -1 if unknown.
+  int64_t cursor = -1;
+
+  // stdio requires a seek when switching between reading and writing.
+  bool writing = false;
+
+  static StdioBackend open(
+    const std::filesystem::path& path,
+    const std::string& modeA,
+    const std::string& modeB,
+    int shareMode
+  ) {
+    StdioBackend backend;
+    backend.f = fopen2(path, modeA, modeB, shareMode);
+    return backend;
+  }
+
+  static bool isEmpty(const std::filesystem::path& path) {
+    return diskFileIsEmpty(path);
+  }
+
+  bool isOpen() const {
+    return f != nullptr;
+  }
+
+  void close() {
+    if (f) {
+      fclose(f);
+      f = nullptr;
+    }
+  }
+
+  uint64_t read(int64_t pos, void* buff, uint64_t n) {
+    seekTo(pos, false);
+    const auto bytesRead = std::fread(buff, 1, n, f);
+    cursor += bytesRead;
+
+    if (bytesRead < n) {
+      // EOF is sticky, force a seek (which clears it) next time
+      cursor = -1;
+    }
+
+    return bytesRead;
+  }
+
+  void write(int64_t pos, const void* buff, uint64_t n) {
+    seekTo(pos, true);
+
+    if (n == 1) {
+      fputc2(*static_cast<const unsigned char*>(buff), f);
+    } else if (std::fwrite(buff, 1, n, f) != n) {
+      throw std::runtime_error("Write failed. Error code: " + std::to_string(ferror(f)));
+    }
+
+    cursor += n;
+  }
+
+  void sync() {
+    fflush2(f);
+    fsync2(f);
+  }
+
+  int64_t size() {
+    fseek2(f, 0, SEEK_END);
+    cursor = ftell2(f);
+    return cursor;
+  }
+
+  void truncate(int64_t size) {
+    ftruncate2(f, size);
+    cursor = -1;
+  }
+
+  void preallocate(int64_t size) {
+    fflush2(f);
+    #ifndef WIN32
+    fdpreallocate(fileno(f), size);
+    #endif
+  }
+
+  void readahead(int64_t pos, int64_t n) {
+    #ifndef WIN32
+    fdreadahead(fileno(f), pos, n);
+    #endif
+  }
+
+  void copyRange(int64_t dstPos, StdioBackend& src, int64_t srcPos, int64_t n) {
+    fcopyrange2(src.f, srcPos, f, dstPos, n);
+    cursor = -1;
+    src.cursor = -1;
+  }
+
+  void discardCache() {
+    // fflush drops the read buffer of an input stream
+    std::fflush(f);
+    cursor = -1;
+  }
+
+private:
+  void seekTo(int64_t pos, bool write) {
+    if (pos != cursor || write != writing) {
+      fseek2(f, pos, SEEK_SET);
+      cursor = pos;
+      writing = write;
+    }
+  }
+};
+
+#ifndef WIN32
+/**
+ * Raw file descriptor storage using pread/pwrite.
+ * A single 64KB buffer serves either as read-ahead or as a write-behind
+ * buffer for sequential (and back-patched) writes, so byte sized
+ * jfputc/jfgetc calls don't turn into one syscall each.
+ */
+struct FdBackend {
+  static constexpr bool kShared = true;
+  static constexpr uint64_t kBufferSize = 64 * 1024;
+
+  int fd = -1;
+
+  std::unique_ptr<unsigned char[]> buffer;
+  int64_t bufferPos = 0;
+  uint64_t bufferLength = 0;
+
+  // True if the buffer holds writes that are not in the file yet.
+  bool dirty = false;
+
+  FdBackend() = default;
+  FdBackend(FdBackend&& other) noexcept { *this = std::move(other); }
+
+  FdBackend& operator=(FdBackend&& other) noexcept {
+    std::swap(fd, other.fd);
+    std::swap(buffer, other.buffer);
+    std::swap(bufferPos, other.bufferPos);
+    std::swap(bufferLength, other.bufferLength);
+    std::swap(dirty, other.dirty);
+    return *this;
+  }
+
+  static FdBackend open(
+    const std::filesystem::path& path,
+    const std::string& modeA,
+    const std::string& modeB,
+    int shareMode
+  ) {
+    const auto& pathStr = path.string();
+
+    FdBackend backend;
+    if ((backend.fd = fdopen2(pathStr.c_str(), modeA, shareMode)) < 0) {
+      if (
+        modeB.empty() ||
+        modeA == modeB ||
+        (backend.fd = fdopen2(pathStr.c_str(), modeB, shareMode)) < 0
+        ) {
+        throw std::runtime_error("Cannot open file " + pathStr);
+      }
+    }
+
+    backend.buffer.reset(new unsigned char[kBufferSize]);
+    return backend;
+  }
+
+  static bool isEmpty(const std::filesystem::path& path) {
+    return diskFileIsEmpty(path);
+  }
+
+  ~FdBackend() {
+    if (fd >= 0) {
+      try {
+        flushBuffer();
+      } catch (std::runtime_error&) {
+      }
+
+      ::close(fd);
+    }
+  }
+
+  bool isOpen() const {
+    return fd >= 0;
+  }
+
+  void close() {
+    if (fd >= 0) {
+      flushBuffer();
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  uint64_t read(int64_t pos, void* buff, uint64_t n) {
+    flushBuffer();
+
+    auto out = static_cast<unsigned char*>(buff);
+    uint64_t bytesRead = 0;
+
+    while (bytesRead < n) {
+      if (pos >= bufferPos && pos < bufferPos + int64_t(bufferLength)) {
+        const auto available = std::min<uint64_t>(n - bytesRead, bufferPos + bufferLength - pos);
+        std::memcpy(out + bytesRead, buffer.get() + (pos - bufferPos), available);
+        bytesRead += available;
+        pos += available;
+        continue;
+      }
+
+      if (n - bytesRead >= kBufferSize) {
+        // Large reads skip the buffer
+        const auto got = preadAll(pos, out + bytesRead, n - bytesRead);
+        bytesRead += got;
+        break;
+      }
+
+      bufferPos = pos;
+      bufferLength = preadAll(pos, buffer.get(), kBufferSize);
+      if (bufferLength == 0) {
+        break;
+      }
+    }
+
+    return bytesRead;
+  }
+
+  void write(int64_t pos, const void* buff, uint64_t n) {
+    const auto in = static_cast<const unsigned char*>(buff);
+
+    if (dirty) {
+      const auto bufferEnd = bufferPos + int64_t(bufferLength);
+
+      if (pos >= bufferPos && pos + int64_t(n) <= bufferEnd) {
+        // Back-patch inside the pending writes
+        std::memcpy(buffer.get() + (pos - bufferPos), in, n);
+        return;
+      }
+
+      if (pos == bufferEnd && bufferLength + n <= kBufferSize) {
+        std::memcpy(buffer.get() + bufferLength, in, n);
+        bufferLength += n;
+        return;
+      }
+
+      flushBuffer();
+    }
+
+    // Drop any read-ahead data, it may be stale after this write
+    bufferLength = 0;
+
+    if (n >= kBufferSize) {
+      pwriteAll(pos, in, n);
+      return;
+    }
+
+    std::memcpy(buffer.get(), in, n);
+    bufferPos = pos;
+    bufferLength = n;
+    dirty = true;
+  }
+
+  void sync() {
+    flushBuffer();
+    if (fsync(fd) != 0) {
+      throw std::runtime_error("Fail to commit file");
+    }
+  }
+
+  int64_t size() {
+    flushBuffer();
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      throw std::runtime_error("fstat failed. Error code: " + std::to_string(errno));
+    }
+
+    return st.st_size;
+  }
+
+  void truncate(int64_t size) {
+    flushBuffer();
+    bufferLength = 0;
+
+    if (ftruncate(fd, size) != 0) {
+      throw std::runtime_error("Fail to truncate file");
+    }
+  }
+
+  void preallocate(int64_t size) {
+    flushBuffer();
+    fdpreallocate(fd, size);
+  }
+
+  void readahead(int64_t pos, int64_t n) {
+    fdreadahead(fd, pos, n);
+  }
+
+  void copyRange(int64_t dstPos, FdBackend& src, int64_t srcPos, int64_t n) {
+    src.flushBuffer();
+    flushBuffer();
+    bufferLength = 0;
+
+    #ifdef __linux__
+    fdcopyrange(src.fd, srcPos, fd, dstPos, n);
+    #endif
+
+    while (n > 0) {
+      const auto chunk = std::min<uint64_t>(n, kBufferSize);
+      if (src.preadAll(srcPos, buffer.get(), chunk) != chunk) {
+        throw std::runtime_error("Unexpected EOF while copying file range");
+      }
+
+      pwriteAll(dstPos, buffer.get(), chunk);
+      srcPos += chunk;
+      dstPos += chunk;
+      n -= chunk;
+    }
+  }
+
+  void discardCache() {
+    if (!dirty) {
+      bufferLength = 0;
+    }
+  }
+
+private:
+  void flushBuffer() {
+    if (dirty) {
+      dirty = false;
+      pwriteAll(bufferPos, buffer.get(), bufferLength);
+      bufferLength = 0;
+    }
+  }
+
+  uint64_t preadAll(int64_t pos, unsigned char* buff, uint64_t n) {
+    uint64_t bytesRead = 0;
+    while (bytesRead < n) {
+      const auto got = pread(fd, buff + bytesRead, n - bytesRead, pos + bytesRead);
+      if (got < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+
+        throw std::runtime_error("Read failed. Error code: " + std::to_string(errno));
+      }
+
+      if (got == 0) {
+        break;
+      }
+
+      bytesRead += got;
+    }
+
+    return bytesRead;
+  }
+
+  void pwriteAll(int64_t pos, const unsigned char* buff, uint64_t n) {
+    uint64_t written = 0;
+    while (written < n) {
+      const auto put = pwrite(fd, buff + written, n - written, pos + written);
+      if (put < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+
+        throw std::runtime_error("Write failed. Error code: " + std::to_string(errno));
+      }
+
+      written += put;
+    }
+  }
+};
+#endif
+
+/**
+ * Keeps the file content in memory.
+ * Files live in a process wide table keyed by path, so opening the same
+ * path again (e.g. to test recovery) sees the same content.
+ * Nothing is ever written to disk.
+ */
+struct MemoryBackend {
+  static constexpr bool kShared = false;
+
+  std::shared_ptr<std::vector<unsigned char>> data;
+
+  static std::mutex& registryMutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  static std::map<std::string, std::shared_ptr<std::vector<unsigned char>>>& registry() {
+    static std::map<std::string, std::shared_ptr<std::vector<unsigned char>>> files;
+    return files;
+  }
+
+  static bool tryOpen(const std::string& path, const std::string& mode, MemoryBackend& backend) {
+    auto& files = registry();
+    auto it = files.find(path);
+
+    if (mode.empty() || mode[0] == 'r') {
+      if (it == files.end()) {
+        return false;
+      }
+    } else if (it == files.end()) {
+      it = files.emplace(path, std::make_shared<std::vector<unsigned char>>()).first;
+    } else if (mode[0] == 'w') {
+      it->second->clear();
+    }
+
+    backend.data = it->second;
+    return true;
+  }
+
+  static MemoryBackend open(
+    const std::filesystem::path& path,
+    const std::string& modeA,
+    const std::string& modeB,
+    int
+  ) {
+    const auto& pathStr = path.string();
+    std::lock_guard<std::mutex> lock(registryMutex());
+
+    MemoryBackend backend;
+    if (!tryOpen(pathStr, modeA, backend)) {
+      if (modeB.empty() || modeA == modeB || !tryOpen(pathStr, modeB, backend)) {
+        throw std::runtime_error("Cannot open file " + pathStr);
+      }
+    }
+
+    return backend;
+  }
+
+  static bool isEmpty(const std::filesystem::path& path) {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    const auto it = registry().find(path.string());
+    return it == registry().end() || it->second->empty();
+  }
+
+  /**
+   * Drops the in-memory file. Open handles keep their content alive.
+   */
+  static void remove(const std::filesystem::path& path) {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry().erase(path.string());
+  }
+
+  bool isOpen() const {
+    return data != nullptr;
+  }
+
+  void close() {
+    data.reset();
+  }
+
+  uint64_t read(int64_t pos, void* buff, uint64_t n) {
+    if (pos >= int64_t(data->size())) {
+      return 0;
+    }
+
+    const auto bytesRead = std::min<uint64_t>(n, data->size() - pos);
+    std::memcpy(buff, data->data() + pos, bytesRead);
+    return bytesRead;
+  }
+
+  void write(int64_t pos, const void* buff, uint64_t n) {
+    if (pos + n > data->size()) {
+      data->resize(pos + n);
+    }
+
+    std::memcpy(data->data() + pos, buff, n);
+  }
+
+  void sync() {
+  }
+
+  int64_t size() {
+    return data->size();
+  }
+
+  void truncate(int64_t size) {
+    data->resize(size);
+  }
+
+  void preallocate(int64_t size) {
+    data->reserve(size);
+  }
+
+  void readahead(int64_t, int64_t) {
+  }
+
+  void copyRange(int64_t dstPos, MemoryBackend& src, int64_t srcPos, int64_t n) {
+    if (srcPos + n > int64_t(src.data->size())) {
+      throw std::runtime_error("Unexpected EOF while copying file range");
+    }
+
+    if (dstPos + n > int64_t(data->size())) {
+      data->resize(dstPos + n);
+    }
+
+    std::memmove(data->data() + dstPos, src.data->data() + srcPos, n);
+  }
+
+  void discardCache() {
+  }
+};
+
+}
@@ -0,0 +1,338 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "varint.h"
+
+namespace jfio {
+
+// Codecs for journal block payloads (see jfsetcompression).
+// Blocks are compressed one at a time and decompressed in one piece,
+// so memory use is bounded by the block size.
+
+constexpr int kCodecNone = 0;
+
+// Zero-run elision: repeated [varint literal count][literals][varint zero count].
+// Cheap, and enough for sparse or zero-filled regions.
+constexpr int kCodecZeroRuns = 1;
+
+// Byte oriented LZ77 with a 64KB window, in the style of LZ4 blocks.
+// Every sequence is: a token (high 4 bits: literal count, low 4 bits: match length - 4,
+// 15 meaning extra length bytes follow, each adding up to 255), the literals,
+// then a 2 byte little endian match offset and the extra match length bytes.
+// The last sequence only has literals.
+constexpr int kCodecLZ = 2;
+
+constexpr int kNumCodecs = 3;
+
+// Zero runs shorter than this are cheaper to keep as literals
+constexpr uint64_t kMinZeroRun = 8;
+
+constexpr int kLZMinMatch = 4;
+constexpr int kLZHashBits = 13;
+constexpr uint64_t kLZMaxOffset = 65535;
+
+// Matches do not start in the last bytes of the input, and do not reach into
+// the last kLZLastLiterals bytes, so the decoder never needs to look past a sequence.
+constexpr uint64_t kLZMatchLimit = 12;
+constexpr uint64_t kLZLastLiterals = 5;
+
+static inline void putVarint(uint64_t value, std::vector<unsigned char>& out) {
+  unsigned char buff[kMaxVarintBytes];
+  out.insert(out.end(), buff, buff + encodeVarint(value, buff));
+}
+
+static inline void compressZeroRuns(const unsigned char* in, uint64_t n, std::vector<unsigned char>& out) {
+  uint64_t literalStart = 0;
+  uint64_t i = 0;
+
+  while (i < n) {
+    // Skip quickly over words without a zero byte
+    if (i + 8 <= n) {
+      const auto word = loadLittleEndian64(in + i);
+      if (((word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+
+    if (in[i] != 0) {
+      i++;
+      continue;
+    }
+
+    uint64_t runEnd = i;
+    while (runEnd + 8 <= n && loadLittleEndian64(in + runEnd) == 0) {
+      runEnd += 8;
+    }
+
+    while (runEnd < n && in[runEnd] == 0) {
+      runEnd++;
+    }
+
+    if (runEnd - i >= kMinZeroRun || runEnd == n) {
+      putVarint(i - literalStart, out);
+      out.insert(out.end(), in + literalStart, in + i);
+      putVarint(runEnd - i, out);
+      literalStart = runEnd;
+    }
+
+    i = runEnd;
+  }
+
+  if (literalStart < n) {
+    putVarint(n - literalStart, out);
+    out.insert(out.end(), in + literalStart, in + n);
+    putVarint(0, out);
+  }
+}
+
+static inline bool decompressZeroRuns(const unsigned char* in, uint64_t n, unsigned char* out, uint64_t outLength) {
+  uint64_t pos = 0;
+  uint64_t outPos = 0;
+
+  while (pos < n) {
+    uint64_t literals = 0;
+    auto used = decodeVarint(in + pos, n - pos, literals);
+    if (used == 0 || literals > n - pos - used || literals > outLength - outPos) {
+      return false;
+    }
+
+    pos += used;
+    memcpy(out + outPos, in + pos, size_t(literals));
+    pos += literals;
+    outPos += literals;
+
+    uint64_t zeros = 0;
+    used = decodeVarint(in + pos, n - pos, zeros);
+    if (used == 0 || zeros > outLength - outPos) {
+      return false;
+    }
+
+    pos += used;
+    memset(out + outPos, 0, size_t(zeros));
+    outPos += zeros;
+  }
+
+  return outPos == outLength;
+}
+
+static inline uint32_t load32(const unsigned char* p) {
+  uint32_t x = 0;
+  memcpy(&x, p, 4);
+  return x;
+}
+
+static inline uint32_t lzHash(uint32_t x) {
+  return (x * 2654435761U) >> (32 - kLZHashBits);
+}
+
+static inline void putLZLength(uint64_t length, std::vector<unsigned char>& out) {
+  while (length >= 255) {
+    out.push_back(255);
+    length -= 255;
+  }
+
+  out.push_back(static_cast<unsigned char>(length));
+}
+
+static inline void putLZSequence(
+  const unsigned char* literals,
+  uint64_t literalCount,
+  uint64_t offset,
+  uint64_t matchLength,
+  std::vector<unsigned char>& out
+) {
+  const auto literalNibble = literalCount >= 15 ? 15 : literalCount;
+  const auto matchExtra = matchLength >= kLZMinMatch ? matchLength - kLZMinMatch : 0;
+  const auto matchNibble = matchExtra >= 15 ? 15 : matchExtra;
+
+  out.push_back(static_cast<unsigned char>((literalNibble << 4) | matchNibble));
+  if (literalNibble == 15) {
+    putLZLength(literalCount - 15, out);
+  }
+
+  out.insert(out.end(), literals, literals + literalCount);
+
+  if (matchLength == 0) {
+    return;
+  }
+
+  out.push_back(static_cast<unsigned char>(offset & 0xFF));
+  out.push_back(static_cast<unsigned char>(offset >> 8));
+  if (matchNibble == 15) {
+    putLZLength(matchExtra - 15, out);
+  }
+}
+
+static inline void compressLZ(const unsigned char* in, uint64_t n, std::vector<unsigned char>& out) {
+  // Positions + 1 of the last 4 byte sequence with each hash, 0 if none
+  std::vector<uint32_t> table(size_t(1) << kLZHashBits, 0);
+
+  uint64_t anchor = 0;
+  uint64_t i = 0;
+
+  if (n > kLZMatchLimit) {
+    const auto searchEnd = n - kLZMatchLimit;
+    const auto matchEnd = n - kLZLastLiterals;
+
+    while (i < searchEnd) {
+      const auto h = lzHash(load32(in + i));
+      const uint64_t candidate = table[h];
+      table[h] = uint32_t(i + 1);
+
+      if (candidate == 0 || i - (candidate - 1) > kLZMaxOffset || load32(in + candidate - 1) != load32(in + i)) {
+        // Step faster through data that does not compress
+        i += 1 + ((i - anchor) >> 6);
+        continue;
+      }
+
+      auto ref = candidate - 1;
+      auto length = uint64_t(kLZMinMatch);
+      while (i + length < matchEnd && in[ref + length] == in[i + length]) {
+        length++;
+      }
+
+      // Grow the match backwards into the pending literals
+      while (i > anchor && ref > 0 && in[i - 1] == in[ref - 1]) {
+        i--;
+        ref--;
+        length++;
+      }
+
+      putLZSequence(in + anchor, i - anchor, i - ref, length, out);
+      i += length;
+      anchor = i;
+
+      if (i >= 2 && i < searchEnd) {
+        table[lzHash(load32(in + i - 2))] = uint32_t(i - 2 + 1);
+      }
+    }
+  }
+
+  putLZSequence(in + anchor, n - anchor, 0, 0, out);
+}
+
+static inline bool getLZLength(const unsigned char* in, uint64_t n, uint64_t& pos, uint64_t& length) {
+  while (true) {
+    if (pos >= n) {
+      return false;
+    }
+
+    const auto b = in[pos++];
+    length += b;
+    if (b != 255) {
+      return true;
+    }
+  }
+}
+
+static inline bool decompressLZ(const unsigned char* in, uint64_t n, unsigned char* out, uint64_t outLength) {
+  uint64_t pos = 0;
+  uint64_t outPos = 0;
+
+  while (pos < n) {
+    const auto token = in[pos++];
+
+    uint64_t literals = token >> 4;
+    if (literals == 15 && !getLZLength(in, n, pos, literals)) {
+      return false;
+    }
+
+    if (literals > n - pos || literals > outLength - outPos) {
+      return false;
+    }
+
+    memcpy(out + outPos, in + pos, size_t(literals));
+    pos += literals;
+    outPos += literals;
+
+    if (pos == n) {
+      // The last sequence
+      break;
+    }
+
+    if (n - pos < 2) {
+      return false;
+    }
+
+    const uint64_t offset = in[pos] | (uint64_t(in[pos + 1]) << 8);
+    pos += 2;
+
+    uint64_t length = token & 0x0F;
+    if (length == 15 && !getLZLength(in, n, pos, length)) {
+      return false;
+    }
+
+    length += kLZMinMatch;
+    if (offset == 0 || offset > outPos || length > outLength - outPos) {
+      return false;
+    }
+
+    auto src = out + outPos - offset;
+    auto dst = out + outPos;
+    if (offset >= length) {
+      memcpy(dst, src, size_t(length));
+    } else {
+      // Overlapping match, e.g. a run of one byte
+      for (uint64_t k = 0; k < length; k++) {
+        dst[k] = src[k];
+      }
+    }
+
+    outPos += length;
+  }
+
+  return outPos == outLength;
+}
+
+/**
+ * Appends the compressed form of n bytes to out.
+ */
+static inline void compressBlock(int codec, const unsigned char* in, uint64_t n, std::vector<unsigned char>& out) {
+  switch (codec) {
+  case kCodecZeroRuns:
+    compressZeroRuns(in, n, out);
+    break;
+  case kCodecLZ:
+    compressLZ(in, n, out);
+    break;
+  default:
+    out.insert(out.end(), in, in + n);
+    break;
+  }
+}
+
+/**
+ * Decompresses exactly outLength bytes into out.
+ * Returns false if the input is corrupt.
+ */
+static inline bool decompressBlock(
+  int codec,
+  const unsigned char* in,
+  uint64_t n,
+  unsigned char* out,
+  uint64_t outLength
+) {
+  switch (codec) {
+  case kCodecZeroRuns:
+    return decompressZeroRuns(in, n, out, outLength);
+  case kCodecLZ:
+    return decompressLZ(in, n, out, outLength);
+  case kCodecNone:
+    if (n != outLength) {
+      return false;
+    }
+
+    if (n > 0) {
+      memcpy(out, in, size_t(n));
+    }
+
+    return true;
+  default:
+    return false;
+  }
+}
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "varint.h"
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace jfio {
+
+// Finds the bytes that a write actually changes, so delta journaling
+// (see jfsetdelta) can drop the runs that are already in the main file.
+
+/**
+ * Bit i is set if a[i] == b[i], for 32 bytes.
+ */
+static inline uint32_t equalMask32(const unsigned char* a, const unsigned char* b) {
+  #if defined(__AVX2__)
+  const auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+  const auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+  return uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+  #elif defined(__SSE2__) || defined(_M_X64)
+  const auto x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+  const auto y0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+  const auto x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 16));
+  const auto y1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 16));
+  const auto low = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x0, y0)));
+  const auto high = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x1, y1)));
+  return low | (high << 16);
+  #else
+  uint32_t mask = 0;
+  for (int i = 0; i < 32; i++) {
+    mask |= uint32_t(a[i] == b[i]) << i;
+  }
+
+  return mask;
+  #endif
+}
+
+/**
+ * Appends the [begin, end) ranges where a and b differ to ranges.
+ * Two differences separated by fewer than minEqualRun equal bytes
+ * end up in the same range, so every range is worth a journal block.
+ * Compares 32 bytes per step, equal stretches are skipped a step at a time.
+ */
+static inline void diffRanges(
+  const unsigned char* a,
+  const unsigned char* b,
+  uint64_t n,
+  uint64_t minEqualRun,
+  std::vector<std::pair<uint64_t, uint64_t>>& ranges
+) {
+  for (uint64_t i = 0; i < n; i += 32) {
+    uint32_t mask = 0;
+    if (n - i >= 32) {
+      mask = equalMask32(a + i, b + i);
+    } else {
+      // Bytes past n count as equal
+      mask = ~0U << (n - i);
+      for (uint64_t k = i; k < n; k++) {
+        mask |= uint32_t(a[k] == b[k]) << (k - i);
+      }
+    }
+
+    // Differing bits. Zero extended, so a run reaching the last byte still has an end.
+    uint64_t diff = uint64_t(~mask);
+    while (diff != 0) {
+      const auto start = countTrailingZeros64(diff);
+      const auto end = start + countTrailingZeros64(~(diff >> start));
+
+      const auto begin = i + start;
+      if (!ranges.empty() && begin - ranges.back().second < std::max<uint64_t>(minEqualRun, 1)) {
+        ranges.back().second = i + end;
+      } else {
+        ranges.emplace_back(begin, i + end);
+      }
+
+      diff &= ~((uint64_t(1) << end) - 1);
+    }
+  }
+}
+
+}
@@ -2,12 +2,71 @@
 
 #include <ios>
 #include <cctype>
+#include <filesystem>
+#include <map>
+#include <vector>
+#include "jfbackend.h"
+#include "jfcompress.h"
+#include "jfseqlock.h"
 
 namespace jfio {
 
-struct JFile {
-  std::FILE* f = nullptr;
-  std::FILE* jf = nullptr;
+/**
+ * Counters since the file was opened.
+ */
+struct JFStats {
+  // Delta journaling (see jfsetdelta): bytes compared against the main file,
+  // how many of them were dropped as unchanged, and the time spent
+  // reading the main file and comparing.
+  uint64_t deltaComparedBytes = 0;
+  uint64_t deltaDroppedBytes = 0;
+  uint64_t deltaCompareNanos = 0;
+
+  // Compression (see jfsetcompression): bytes given to the codec, bytes
+  // journaled for them (raw if compressing did not help), and the time spent
+  // compressing blocks and decompressing them during replay.
+  uint64_t compressInputBytes = 0;
+  uint64_t compressOutputBytes = 0;
+  uint64_t compressNanos = 0;
+  uint64_t decompressNanos = 0;
+};
+
+/**
+ * Session state captured by jfsavepoint, restored by jfrollback.
+ * Savepoints are taken with the current block closed.
+ */
+struct JFSavepoint {
+  int64_t pos = 0;
+  int64_t maxPos = 0;
+  int64_t journalEndPos = 0;
+  int64_t numCompletedBlocks = 0;
+  bool hasDirectWrites = false;
+  bool fullyJournaled = false;
+  int64_t dirtyBegin = 0;
+  int64_t dirtyEnd = 0;
+  int64_t copySourceBegin = 0;
+  int64_t copySourceEnd = 0;
+};
+
+/**
+ * A journaled file on top of a storage backend (see jfbackend.h).
+ * f is the main file, jf is the journal.
+ */
+template<typename _t_backend>
+struct BasicJFile {
+  _t_backend f;
+  _t_backend jf;
+
+  // Path of the main file. Recorded in the journal when
+  // this file is the source of a cross-file jfcopyrange.
+  std::filesystem::path path;
+
+  // The journal is only opened once a session starts writing,
+  // unless recovery had to inspect it (see jfopen).
+  std::filesystem::path journalPath;
+
+  // Share mode the file was opened with.
+  int shareMode = 0;
 
   // Current position of the main file.
   int64_t pos = 0;
@@ -33,5 +92,89 @@ struct JFile {
   // Length of the current block, start counting
   // from journal block start (i.e. including block header bytes).
   int64_t currentBlockLength = 0;
+
+  // True once the current session has appended bytes past
+  // lastPersistedMaxPos directly into the main file.
+  bool hasDirectWrites = false;
+
+  // Set once the session journals a copy or truncate operation.
+  // Appends then go through the journal as well, so that replay
+  // applies everything in the order it was issued.
+  bool fullyJournaled = false;
+
+  // Span of the main file touched by journaled writes in this session.
+  // Empty when dirtyEnd <= dirtyBegin.
+  int64_t dirtyBegin = 0;
+  int64_t dirtyEnd = 0;
+
+  // Span read by journaled copies within this file.
+  // It must stay untouched until the session is flushed,
+  // otherwise replaying the journal twice would not be idempotent.
+  int64_t copySourceBegin = 0;
+  int64_t copySourceEnd = 0;
+
+  // Journaled writes are held back in pendingBuffer (bytes for
+  // [pendingPos, pendingPos + size)) until the block closes, in delta mode
+  // or with a codec set. Delta journaling then only journals the ranges
+  // that differ from the main file, and the codec compresses the block.
+  std::vector<unsigned char> pendingBuffer;
+  int64_t pendingPos = 0;
+
+  bool deltaMode = false;
+
+  // Codec for journal blocks written in memory (see jfsetcompression)
+  int codec = kCodecNone;
+
+  // Scratch space for blocks built in memory
+  std::vector<unsigned char> blockBuffer;
+
+  // Ranges journaled in this session in delta mode (begin -> end).
+  // Unchanged bytes inside them cannot be dropped, since the journal
+  // already holds different content for them.
+  std::map<int64_t, int64_t> deltaJournaled;
+
+  // Savepoints of the current session, oldest first.
+  std::vector<JFSavepoint> savepoints;
+
+  // Highest maxPos of a savepoint in this session. Writes below it are
+  // journaled even past lastPersistedMaxPos, since appending directly
+  // would overwrite bytes that a rollback must bring back.
+  int64_t savepointMaxPos = 0;
+
+  JFStats stats;
+
+  // Commit counter shared with other processes opening the same file.
+  // Closed for exclusive opens and for backends other processes cannot see.
+  JFSeqLock seqlock;
+
+  // Set when a writer opened with the counter already up to date,
+  // so it is only mapped once the first session starts.
+  bool seqlockDeferred = false;
+
+  // Last commit sequence this (reading) file has seen.
+  uint64_t seenSequence = 0;
 };
+
+using JFile = BasicJFile<StdioBackend>;
+
+/**
+ * True for a file opened read-only while the shared commit counter is available.
+ * Its reads must not see a commit that another process is replaying.
+ */
+template<typename _t_backend>
+static inline bool isSharedReader(const BasicJFile<_t_backend>& file) {
+  return file.seqlock.isOpen() && file.shareMode == SHARE_MODE_READ_ONLY;
+}
+
+/**
+ * Reads at most n bytes of the main file at pos (short read at EOF).
+ */
+template<typename _t_backend>
+static inline uint64_t readMainFile(BasicJFile<_t_backend>& file, int64_t pos, void* buff, uint64_t n) {
+  if (isSharedReader(file)) {
+    return seqlockRead(file.seqlock, file.seenSequence, file.f, pos, buff, n);
+  }
+
+  return file.f.read(pos, buff, n);
+}
 }
\ No newline at end of file
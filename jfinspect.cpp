@@ -0,0 +1,570 @@
+#include "jfinspect.h"
+
+#include <chrono>
+#include <map>
+#include <stdexcept>
+#include "jfcompress.h"
+#include "jfio.h"
+#include "jfjournal.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace jfio {
+
+static inline int64_t chunkCount(int64_t n, int64_t chunkBytes) {
+  return (n + chunkBytes - 1) / chunkBytes;
+}
+
+template<typename _t_backend>
+static inline bool readContent(_t_backend& b, int64_t pos, int64_t n, vector<unsigned char>& out) {
+  out.resize(static_cast<size_t>(n));
+  return b.read(pos, out.data(), uint64_t(n)) == uint64_t(n);
+}
+
+/**
+ * The table length of a batch block, or -1 if it does not fit the content.
+ */
+static inline int64_t batchTableBytes(const unsigned char* content, int64_t contentLength) {
+  if (contentLength < 8) {
+    return -1;
+  }
+
+  const auto tableBytes = decodeInt(content, 8);
+  return tableBytes < 1 || tableBytes > contentLength - 8 ? -1 : tableBytes;
+}
+
+/**
+ * Fills the ranges of a batch block (see replayBatchBlock).
+ * content holds at least the table length and the table.
+ * Returns false if the table is invalid.
+ */
+static inline bool decodeBatch(const unsigned char* content, int64_t contentLength, JFJournalBlock& block) {
+  const auto tableBytes = batchTableBytes(content, contentLength);
+  if (tableBytes < 0) {
+    return false;
+  }
+
+  const auto table = content + 8;
+  uint64_t count = 0;
+  const auto used = decodeVarint(table, uint64_t(tableBytes), count);
+  if (used == 0 || count > uint64_t(tableBytes)) {
+    return false;
+  }
+
+  vector<uint64_t> values(static_cast<size_t>(count * 2));
+  uint64_t consumed = 0;
+  if (decodeVarints(table + used, uint64_t(tableBytes) - used, values.data(), values.size(), consumed) != values.size()) {
+    return false;
+  }
+
+  int64_t end = 0;
+  int64_t dataBytes = 0;
+  for (size_t i = 0; i < values.size(); i += 2) {
+    const auto pos = end + int64_t(values[i]);
+    const auto length = int64_t(values[i + 1]);
+    block.ranges.push_back({ pos, length });
+    end = pos + length;
+    dataBytes += length;
+  }
+
+  return dataBytes == contentLength - 8 - tableBytes;
+}
+
+/**
+ * Fills the replay estimate of a block, following what replayBlock does.
+ * inMemory is true for compressed blocks: their content is read in one go,
+ * then replayed from memory.
+ */
+static inline void estimateReplay(JFJournalBlock& block, int64_t headerBytes, bool inMemory) {
+  // Block header
+  block.replayReads = 1;
+  block.replayReadBytes = headerBytes;
+
+  if (inMemory) {
+    block.replayReads++;
+    block.replayReadBytes += block.length - headerBytes;
+  }
+
+  const auto readJournal = [&](int64_t n, int64_t calls) {
+    if (!inMemory) {
+      block.replayReads += uint64_t(calls);
+      block.replayReadBytes += n;
+    }
+  };
+
+  switch (block.type) {
+  case kBlockTruncate:
+    block.replayWrites = 1;
+    break;
+  case kBlockCopy: {
+    readJournal(block.rawLength, 3);
+    const auto count = block.ranges.empty() ? 0 : block.ranges.front().length;
+    block.replayReads++;
+    block.replayReadBytes += count;
+    block.replayWrites = 1;
+    block.replayWriteBytes = count;
+    break;
+  }
+  case kBlockBatch: {
+    const auto& ranges = block.ranges;
+    // Table length and table
+    int64_t tableBytes = block.rawLength;
+    for (const auto& range : ranges) {
+      tableBytes -= range.length;
+    }
+
+    readJournal(tableBytes, 2);
+
+    // Same grouping as replayBatchBlock
+    for (size_t i = 0; i < ranges.size();) {
+      const auto begin = ranges[i].pos;
+      auto groupEnd = begin + ranges[i].length;
+      auto groupBytes = ranges[i].length;
+
+      size_t j = i + 1;
+      while (j < ranges.size() &&
+        ranges[j].pos - groupEnd <= kBatchCoalesceGapBytes &&
+        ranges[j].pos + ranges[j].length - begin <= kReplayChunkBytes) {
+        groupEnd = ranges[j].pos + ranges[j].length;
+        groupBytes += ranges[j].length;
+        j++;
+      }
+
+      if (j == i + 1) {
+        const auto chunks = chunkCount(groupBytes, kReplayChunkBytes);
+        readJournal(groupBytes, chunks);
+        block.replayWrites += uint64_t(chunks);
+        block.replayWriteBytes += groupBytes;
+      } else {
+        // Read the span, patch it, write it back
+        readJournal(groupBytes, 1);
+        block.replayReads++;
+        block.replayReadBytes += groupEnd - begin;
+        block.replayWrites++;
+        block.replayWriteBytes += groupEnd - begin;
+      }
+
+      i = j;
+    }
+
+    break;
+  }
+  default: {
+    const auto chunks = chunkCount(block.rawLength, kReplayChunkBytes);
+    readJournal(block.rawLength, chunks);
+    block.replayWrites = uint64_t(chunks);
+    block.replayWriteBytes = block.rawLength;
+    break;
+  }
+  }
+}
+
+/**
+ * Decodes the content of a block: its ranges, and for compressed blocks its raw length.
+ * Returns an error message, empty if the content is valid.
+ */
+template<typename _t_backend>
+static inline string decodeContent(_t_backend& jf, int64_t contentPos, int64_t contentLength, JFJournalBlock& block) {
+  vector<unsigned char> content;
+  vector<unsigned char> raw;
+  const unsigned char* data = nullptr;
+
+  if (block.codec != kCodecNone) {
+    if (contentLength < 8 || !readContent(jf, contentPos, contentLength, content)) {
+      return "invalid compressed block";
+    }
+
+    block.rawLength = decodeInt(content.data(), 8);
+    if (block.rawLength < 0) {
+      return "invalid compressed block";
+    }
+
+    // Replay refuses these too (see kMaxCompressedRawBytes)
+    if (block.rawLength > kMaxCompressedRawBytes) {
+      return "compressed block raw length " + to_string(block.rawLength) + " is too large";
+    }
+
+    raw.resize(static_cast<size_t>(block.rawLength));
+    if (!decompressBlock(block.codec, content.data() + 8, content.size() - 8, raw.data(), raw.size())) {
+      return "corrupt compressed content";
+    }
+
+    data = raw.data();
+  } else {
+    block.rawLength = contentLength;
+  }
+
+  switch (block.type) {
+  case kBlockTruncate:
+    if (block.pos < 0) {
+      return "negative truncate length";
+    }
+
+    break;
+  case kBlockCopy: {
+    if (block.rawLength < 16) {
+      return "invalid copy block";
+    }
+
+    if (!data) {
+      if (!readContent(jf, contentPos, contentLength, content)) {
+        return "unexpected end of journal";
+      }
+
+      data = content.data();
+    }
+
+    block.copySourcePos = decodeInt(data, 8);
+    const auto count = decodeInt(data + 8, 8);
+    if (block.copySourcePos < 0 || count < 0) {
+      return "invalid copy block";
+    }
+
+    block.copySourcePath.assign(reinterpret_cast<const char*>(data) + 16, size_t(block.rawLength - 16));
+    block.ranges.push_back({ block.pos, count });
+    break;
+  }
+  case kBlockBatch:
+    if (!data) {
+      // Only the table is needed
+      unsigned char lengthBytes[8];
+      if (contentLength < 8 || jf.read(contentPos, lengthBytes, 8) != 8) {
+        return "invalid batch block";
+      }
+
+      const auto tableBytes = batchTableBytes(lengthBytes, contentLength);
+      if (tableBytes < 0 || !readContent(jf, contentPos, 8 + tableBytes, content)) {
+        return "invalid batch block";
+      }
+
+      data = content.data();
+    }
+
+    if (!decodeBatch(data, block.rawLength, block)) {
+      return "invalid batch block";
+    }
+
+    break;
+  case kBlockData:
+    if (block.pos < 0) {
+      return "negative data position";
+    }
+
+    if (block.rawLength > 0) {
+      block.ranges.push_back({ block.pos, block.rawLength });
+    }
+
+    break;
+  default:
+    return "unknown block type " + to_string(block.type);
+  }
+
+  return "";
+}
+
+/**
+ * Adds [begin, end) to the disjoint ranges of written.
+ * Returns how many of those bytes were already there.
+ */
+static inline int64_t addWritten(map<int64_t, int64_t>& written, int64_t begin, int64_t end) {
+  int64_t covered = 0;
+
+  auto it = written.upper_bound(begin);
+  if (it != written.begin() && prev(it)->second >= begin) {
+    --it;
+  }
+
+  while (it != written.end() && it->first <= end) {
+    covered += max<int64_t>(0, min(end, it->second) - max(begin, it->first));
+    begin = min(begin, it->first);
+    end = max(end, it->second);
+    it = written.erase(it);
+  }
+
+  written.emplace(begin, end);
+  return covered;
+}
+
+/**
+ * Drops everything past length from written.
+ */
+static inline void truncateWritten(map<int64_t, int64_t>& written, int64_t length) {
+  auto it = written.lower_bound(length);
+  written.erase(it, written.end());
+
+  if (!written.empty() && prev(written.end())->second > length) {
+    prev(written.end())->second = length;
+  }
+}
+
+/**
+ * Fills the redundancy and replay totals of info from its blocks.
+ */
+static inline void analyze(JFJournalInfo& info) {
+  map<int64_t, int64_t> written;
+
+  for (const auto& block : info.blocks) {
+    if (block.type == kBlockTruncate) {
+      truncateWritten(written, block.pos);
+    }
+
+    bool overlapping = false;
+    for (const auto& range : block.ranges) {
+      if (range.length > 0) {
+        info.writtenBytes += range.length;
+        overlapping |= addWritten(written, range.pos, range.pos + range.length) > 0;
+      }
+    }
+
+    info.overlappingBlocks += overlapping ? 1 : 0;
+
+    info.replayReads += block.replayReads;
+    info.replayWrites += block.replayWrites;
+    info.replayReadBytes += block.replayReadBytes;
+    info.replayWriteBytes += block.replayWriteBytes;
+    if (block.codec != kCodecNone) {
+      info.decompressBytes += block.rawLength;
+    }
+  }
+
+  for (const auto& range : written) {
+    info.distinctBytes += range.second - range.first;
+  }
+
+  info.redundantBytes = info.writtenBytes - info.distinctBytes;
+}
+
+template<typename _t_backend>
+static inline JFJournalInfo inspect(_t_backend& jf) {
+  JFJournalInfo info;
+  info.fileSize = jf.size();
+  if (info.fileSize == 0) {
+    // The clean shutdown marker (see jfclose)
+    return info;
+  }
+
+  unsigned char header[kFlagBytes + kVersionBytes + 16] = {};
+  const auto headerRead = int64_t(jf.read(0, header, sizeof(header)));
+  info.flag = header[0];
+  if (info.flag != kJournaling && info.flag != kJournalReady && info.flag != kJournalCleared) {
+    info.error = "unknown flag " + to_string(info.flag);
+    return info;
+  }
+
+  if (headerRead < kFlagBytes + kVersionBytes) {
+    info.error = "header cut short";
+    return info;
+  }
+
+  info.version = int32_t(decodeInt(header + kFlagBytes, kVersionBytes));
+  if (info.version < 1 || info.version > kJournalVersion) {
+    info.error = "unknown version " + to_string(info.version);
+    return info;
+  }
+
+  const int64_t headerBytes = kFlagBytes + kVersionBytes + (info.version >= 2 ? 16 : 8);
+  if (headerRead < headerBytes) {
+    info.error = "header cut short";
+    return info;
+  }
+
+  info.numBlocks = decodeInt(header + kFlagBytes + kVersionBytes, 8);
+  if (info.version >= 2) {
+    info.originalLength = decodeInt(header + kFlagBytes + kVersionBytes + 8, 8);
+  }
+
+  if (info.numBlocks < 0) {
+    info.error = "negative block count";
+    return info;
+  }
+
+  const int64_t blockHeaderBytes = info.version >= 3 ? 17 : 16;
+  int64_t journalPos = headerBytes;
+
+  for (int64_t i = 0; i < info.numBlocks; i++) {
+    const auto fail = [&](const string& message) {
+      info.error = "block " + to_string(i) + " at " + to_string(journalPos) + ": " + message;
+    };
+
+    unsigned char blockHeader[17] = {};
+    if (jf.read(journalPos, blockHeader, uint64_t(blockHeaderBytes)) != uint64_t(blockHeaderBytes)) {
+      fail("unexpected end of journal");
+      break;
+    }
+
+    JFJournalBlock block;
+    block.journalPos = journalPos;
+    block.length = decodeInt(blockHeader, 8);
+    block.pos = decodeInt(blockHeader + 8, 8);
+    if (info.version >= 3) {
+      block.type = blockHeader[16] & kBlockTypeMask;
+      block.codec = blockHeader[16] >> kBlockCodecShift;
+    }
+
+    if (block.length < blockHeaderBytes) {
+      fail("invalid block length " + to_string(block.length));
+      break;
+    }
+
+    if (block.length > info.fileSize - journalPos) {
+      fail("block runs past the end of the journal");
+      break;
+    }
+
+    if (block.codec >= kNumCodecs) {
+      fail("unknown codec " + to_string(block.codec));
+      break;
+    }
+
+    const auto error = decodeContent(jf, journalPos + blockHeaderBytes, block.length - blockHeaderBytes, block);
+    if (!error.empty()) {
+      fail(error);
+      break;
+    }
+
+    estimateReplay(block, blockHeaderBytes, block.codec != kCodecNone);
+    info.blocks.push_back(move(block));
+    journalPos += info.blocks.back().length;
+  }
+
+  if (info.error.empty()) {
+    info.trailingBytes = info.fileSize - journalPos;
+  }
+
+  analyze(info);
+  return info;
+}
+
+template<typename _t_backend>
+JFJournalInfo jfinspect(const fs::path& journalFilePath) {
+  auto jf = _t_backend::open(journalFilePath, "rb", "", SHARE_MODE_READ_ONLY);
+  try {
+    auto info = inspect(jf);
+    jf.close();
+    return info;
+  } catch (...) {
+    jf.close();
+    throw;
+  }
+}
+
+/**
+ * Copies the file at from to to, replacing it. A missing file copies as an empty one.
+ */
+template<typename _t_backend>
+static inline void copyFile(const fs::path& from, const fs::path& to) {
+  auto dst = _t_backend::open(to, "wb+", "", SHARE_MODE_EXCLUSIVE);
+  if (_t_backend::isEmpty(from)) {
+    dst.close();
+    return;
+  }
+
+  auto src = _t_backend::open(from, "rb", "", SHARE_MODE_READ_ONLY);
+  try {
+    vector<unsigned char> buff(static_cast<size_t>(kReplayChunkBytes));
+    int64_t pos = 0;
+    while (const auto n = src.read(pos, buff.data(), buff.size())) {
+      dst.write(pos, buff.data(), n);
+      pos += int64_t(n);
+    }
+  } catch (...) {
+    src.close();
+    dst.close();
+    throw;
+  }
+
+  src.close();
+  dst.sync();
+  dst.close();
+}
+
+/**
+ * True if a and b name the same file, through links or relative paths.
+ */
+static inline bool sameFile(const fs::path& a, const fs::path& b) {
+  error_code ec;
+  if (fs::equivalent(a, b, ec)) {
+    return true;
+  }
+
+  return fs::weakly_canonical(a) == fs::weakly_canonical(b);
+}
+
+template<typename _t_backend>
+JFDryRun jfdryrun(const fs::path& mainFilePath, const fs::path& journalFilePath, const fs::path& copyFilePath) {
+  auto copyJournalPath = copyFilePath;
+  copyJournalPath += ".journal";
+
+  // The copies are truncated before anything is read, so they must not be the originals
+  for (const auto& copy : { copyFilePath, copyJournalPath }) {
+    for (const auto& original : { mainFilePath, journalFilePath }) {
+      if (sameFile(copy, original)) {
+        throw runtime_error("jfdryrun: " + copy.string() + " is the main file or the journal");
+      }
+    }
+
+    if (!_t_backend::isEmpty(copy)) {
+      throw runtime_error("jfdryrun: " + copy.string() + " already exists");
+    }
+  }
+
+  copyFile<_t_backend>(mainFilePath, copyFilePath);
+  copyFile<_t_backend>(journalFilePath, copyJournalPath);
+
+  JFDryRun result;
+
+  if (!_t_backend::isEmpty(copyJournalPath)) {
+    // Replay whatever the journal holds, committed or not
+    auto jf = _t_backend::open(copyJournalPath, "rb+", "", SHARE_MODE_EXCLUSIVE);
+    const auto ch = static_cast<unsigned char>(kJournalReady);
+    jf.write(0, &ch, 1);
+    jf.sync();
+    jf.close();
+  }
+
+  {
+    auto f = _t_backend::open(copyFilePath, "rb", "", SHARE_MODE_READ_ONLY);
+    result.sizeBefore = f.size();
+    f.close();
+  }
+
+  const auto start = chrono::steady_clock::now();
+  auto file = jfopen<_t_backend>(copyFilePath, copyJournalPath, "rb+", "rb+", SHARE_MODE_EXCLUSIVE);
+  result.nanos = uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+  result.decompressNanos = file.stats.decompressNanos;
+  result.sizeAfter = file.maxPos;
+  jfclose(file);
+
+  error_code ec;
+  fs::remove(copyJournalPath, ec);
+
+  return result;
+}
+
+const char* jfblocktypename(int type) {
+  switch (type) {
+  case kBlockData:
+    return "data";
+  case kBlockCopy:
+    return "copy";
+  case kBlockTruncate:
+    return "truncate";
+  case kBlockBatch:
+    return "batch";
+  default:
+    return "unknown";
+  }
+}
+
+#define JFINSPECT_INSTANTIATE(B) \
+  template JFJournalInfo jfinspect<B>(const fs::path&); \
+  template JFDryRun jfdryrun<B>(const fs::path&, const fs::path&, const fs::path&);
+
+JFINSPECT_INSTANTIATE(StdioBackend)
+JFINSPECT_INSTANTIATE(MemoryBackend)
+#ifndef WIN32
+JFINSPECT_INSTANTIATE(FdBackend)
+#endif
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "jfile.h"
+
+namespace jfio {
+
+// Offline analysis of journal files, for jfio_inspect.
+// Nothing here changes the journal or the main file.
+
+/**
+ * Bytes [pos, pos + length) of the main file.
+ */
+struct JFJournalRange {
+  int64_t pos = 0;
+  int64_t length = 0;
+};
+
+/**
+ * A block of the journal, as replay would see it.
+ */
+struct JFJournalBlock {
+  // Where the block starts in the journal, and its length there (header included).
+  int64_t journalPos = 0;
+  int64_t length = 0;
+
+  int type = 0;
+  int codec = 0;
+
+  // Position from the block header. For truncate blocks, the new file length.
+  int64_t pos = 0;
+
+  // Content length once decompressed.
+  int64_t rawLength = 0;
+
+  // Main file bytes written by data, batch and copy blocks.
+  std::vector<JFJournalRange> ranges;
+
+  // Copy blocks only. The path is empty when copying within the main file.
+  int64_t copySourcePos = 0;
+  std::string copySourcePath;
+
+  // Estimated replay work: backend calls and bytes moved.
+  uint64_t replayReads = 0;
+  uint64_t replayWrites = 0;
+  int64_t replayReadBytes = 0;
+  int64_t replayWriteBytes = 0;
+};
+
+/**
+ * What a journal holds, and what replaying it costs.
+ */
+struct JFJournalInfo {
+  int64_t fileSize = 0;
+
+  // Header. originalLength is -1 for version 1 journals.
+  int flag = 0;
+  int32_t version = 0;
+  int64_t numBlocks = 0;
+  int64_t originalLength = -1;
+
+  // The decoded blocks, and what follows them: a block still being written, if journaling.
+  std::vector<JFJournalBlock> blocks;
+  int64_t trailingBytes = 0;
+
+  // Why decoding stopped early, empty if the journal is valid.
+  std::string error;
+
+  // Main file bytes written by the blocks, and how many distinct bytes that is.
+  // Bytes written more than once, or cut by a later truncate, are redundant.
+  int64_t writtenBytes = 0;
+  int64_t distinctBytes = 0;
+  int64_t redundantBytes = 0;
+
+  // Blocks writing over bytes written by an earlier block.
+  int64_t overlappingBlocks = 0;
+
+  // Replay totals (see JFJournalBlock), plus the bytes to decompress.
+  uint64_t replayReads = 0;
+  uint64_t replayWrites = 0;
+  int64_t replayReadBytes = 0;
+  int64_t replayWriteBytes = 0;
+  int64_t decompressBytes = 0;
+};
+
+/**
+ * The result of jfdryrun.
+ */
+struct JFDryRun {
+  uint64_t nanos = 0;
+  uint64_t decompressNanos = 0;
+
+  int64_t sizeBefore = 0;
+  int64_t sizeAfter = 0;
+};
+
+/**
+ * Decodes and validates the journal at journalFilePath.
+ * Structural problems do not throw: they end the block list and set error.
+ * Throws a runtime_error if the journal cannot be opened.
+ */
+template<typename _t_backend = StdioBackend>
+JFJournalInfo jfinspect(const std::filesystem::path& journalFilePath);
+
+/**
+ * Replays the journal against a copy of the main file, written to copyFilePath,
+ * the way jfopen would after a crash. The journal is copied too, so neither
+ * original changes. Journals not marked ready ('J' or 'C') are replayed as if
+ * they were, to see what committing them would do.
+ * Throws a runtime_error, before writing anything, if the copy or its journal
+ * (copyFilePath + ".journal") is the main file or the journal, or already holds data.
+ * Throws a runtime_error if replay fails.
+ */
+template<typename _t_backend = StdioBackend>
+JFDryRun jfdryrun(
+  const std::filesystem::path& mainFilePath,
+  const std::filesystem::path& journalFilePath,
+  const std::filesystem::path& copyFilePath
+);
+
+/**
+ * A name for a block type, e.g. "batch".
+ */
+const char* jfblocktypename(int type);
+
+}
@@ -1,74 +1,428 @@
 #include "jfio.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include "file2.h"
+#include "jfcompress.h"
+#include "jfdelta.h"
+#include "jfjournal.h"
 
 using namespace std;
 
 namespace fs = filesystem;
 
-constexpr int kJournaling = 'J';
-constexpr int kJournalReady = 'R';
-constexpr int kJournalCleared = 'C';
-constexpr int kFlagBytes = 1;
-constexpr int kVersionBytes = 4;
+// Smaller blocks are not worth compressing
+constexpr uint64_t kMinCompressBytes = 64;
+
+// Delta journaling and compression work on blocks of at most this many bytes
+constexpr uint64_t kPendingBufferBytes = jfio::kMaxCompressedDataBytes;
+
+// Unchanged runs shorter than this stay in the journal: splitting the block
+// would cost a block header and an extra write at replay.
+constexpr uint64_t kDeltaMinEqualRun = 64;
 
 namespace jfio {
 
-static inline bool flushJournalFile(JFile& file) {
-  fseek2(file.jf, 0, SEEK_SET);
+template<typename _t_backend>
+static inline int32_t readI32(_t_backend& b, int64_t& pos) {
+  unsigned char buff[4];
+  if (b.read(pos, buff, 4) != 4) {
+    throw runtime_error("Failed to read int32");
+  }
+
+  pos += 4;
+  return int32_t(decodeInt(buff, 4));
+}
+
+template<typename _t_backend>
+static inline int64_t readI64(_t_backend& b, int64_t& pos) {
+  unsigned char buff[8];
+  if (b.read(pos, buff, 8) != 8) {
+    throw runtime_error("Failed to read int64");
+  }
+
+  pos += 8;
+  return decodeInt(buff, 8);
+}
+
+template<typename _t_backend>
+static inline int readFlag(_t_backend& b) {
+  unsigned char ch = 0;
+  return b.read(0, &ch, 1) == 1 ? ch : EOF;
+}
+
+template<typename _t_backend>
+static inline void writeFlag(_t_backend& b, int flag) {
+  const auto ch = static_cast<unsigned char>(flag);
+  b.write(0, &ch, 1);
+}
+
+/**
+ * Applies a copy block to the main file.
+ * The content holds the source position, the byte count and
+ * the source file path (empty when copying within the main file).
+ */
+template<typename _t_backend, typename _t_reader>
+static inline void replayCopyBlock(
+  BasicJFile<_t_backend>& file,
+  _t_reader& content,
+  int64_t& journalPos,
+  int64_t dstPos,
+  int64_t contentLength
+) {
+  if (contentLength < 16) {
+    throw runtime_error("Invalid copy block");
+  }
+
+  const auto srcPos = readI64(content, journalPos);
+  const auto count = readI64(content, journalPos);
+
+  string srcPath(size_t(contentLength - 16), '\0');
+  if (content.read(journalPos, srcPath.data(), srcPath.size()) != srcPath.size()) {
+    throw runtime_error("Unexpected EOF while flushing journal content");
+  }
+
+  journalPos += srcPath.size();
+
+  if (srcPath.empty()) {
+    file.f.copyRange(dstPos, file.f, srcPos, count);
+    return;
+  }
+
+  auto src = _t_backend::open(srcPath, "rb", "", SHARE_MODE_READ_ONLY);
+  try {
+    file.f.copyRange(dstPos, src, srcPos, count);
+  } catch (runtime_error&) {
+    src.close();
+    throw;
+  }
+
+  src.close();
+}
+
+/**
+ * Copies contentLength bytes of the journal to pos in the main file.
+ */
+template<typename _t_backend, typename _t_reader>
+static inline void replayData(
+  BasicJFile<_t_backend>& file,
+  _t_reader& content,
+  int64_t& journalPos,
+  int64_t pos,
+  int64_t contentLength,
+  vector<unsigned char>& buff
+) {
+  buff.resize(size_t(max<int64_t>(buff.size(), min(contentLength, kReplayChunkBytes))));
+  while (contentLength > 0) {
+    const auto chunk = uint64_t(min(contentLength, kReplayChunkBytes));
+    if (content.read(journalPos, buff.data(), chunk) != chunk) {
+      throw runtime_error("Unexpected EOF while flushing journal content");
+    }
+
+    file.f.write(pos, buff.data(), chunk);
+    journalPos += chunk;
+    pos += chunk;
+    contentLength -= chunk;
+  }
+}
+
+/**
+ * Applies a batch block (see jfputbatch) to the main file.
+ * The content holds the table length (8 bytes), the table (varint range count,
+ * then the gap from the previous range end and the length of every range),
+ * and the bytes of all ranges back to back.
+ */
+template<typename _t_backend, typename _t_reader>
+static inline void replayBatchBlock(
+  BasicJFile<_t_backend>& file,
+  _t_reader& content,
+  int64_t& journalPos,
+  int64_t contentLength,
+  vector<unsigned char>& buff
+) {
+  if (contentLength < 8) {
+    throw runtime_error("Invalid batch block");
+  }
+
+  const auto tableBytes = readI64(content, journalPos);
+  if (tableBytes < 1 || tableBytes > contentLength - 8) {
+    throw runtime_error("Invalid batch block");
+  }
+
+  vector<unsigned char> table(static_cast<size_t>(tableBytes));
+  if (content.read(journalPos, table.data(), table.size()) != table.size()) {
+    throw runtime_error("Unexpected EOF while flushing journal content");
+  }
+
+  journalPos += tableBytes;
+
+  uint64_t count = 0;
+  const auto used = decodeVarint(table.data(), table.size(), count);
+  if (used == 0 || count > table.size()) {
+    throw runtime_error("Invalid batch block");
+  }
+
+  vector<uint64_t> values(size_t(count * 2));
+  uint64_t consumed = 0;
+  if (decodeVarints(table.data() + used, table.size() - used, values.data(), values.size(), consumed) != values.size()) {
+    throw runtime_error("Invalid batch block");
+  }
+
+  // Turn the gaps into positions
+  int64_t end = 0;
+  int64_t dataBytes = 0;
+  for (size_t i = 0; i < values.size(); i += 2) {
+    values[i] += end;
+    end = int64_t(values[i] + values[i + 1]);
+    dataBytes += int64_t(values[i + 1]);
+  }
+
+  if (dataBytes != contentLength - 8 - tableBytes) {
+    throw runtime_error("Invalid batch block");
+  }
+
+  vector<unsigned char> span;
+  for (size_t i = 0; i < values.size();) {
+    const auto begin = int64_t(values[i]);
+    auto groupEnd = begin + int64_t(values[i + 1]);
+    int64_t groupBytes = int64_t(values[i + 1]);
+
+    size_t j = i + 2;
+    while (j < values.size() &&
+      int64_t(values[j]) - groupEnd <= kBatchCoalesceGapBytes &&
+      int64_t(values[j] + values[j + 1]) - begin <= kReplayChunkBytes) {
+      groupEnd = int64_t(values[j] + values[j + 1]);
+      groupBytes += int64_t(values[j + 1]);
+      j += 2;
+    }
+
+    if (j == i + 2) {
+      replayData(file, content, journalPos, begin, groupBytes, buff);
+      i = j;
+      continue;
+    }
+
+    // Patch the ranges into the current content of the span, and write it back at once
+    span.resize(size_t(groupEnd - begin));
+    const auto bytesRead = file.f.read(begin, span.data(), span.size());
+    memset(span.data() + bytesRead, 0, span.size() - bytesRead);
+
+    buff.resize(size_t(max<int64_t>(buff.size(), groupBytes)));
+    if (content.read(journalPos, buff.data(), uint64_t(groupBytes)) != uint64_t(groupBytes)) {
+      throw runtime_error("Unexpected EOF while flushing journal content");
+    }
+
+    journalPos += groupBytes;
+
+    uint64_t offset = 0;
+    for (; i < j; i += 2) {
+      memcpy(span.data() + (values[i] - begin), buff.data() + offset, size_t(values[i + 1]));
+      offset += values[i + 1];
+    }
+
+    file.f.write(begin, span.data(), span.size());
+  }
+}
+
+/**
+ * Applies one block. Its content is read from content, starting at journalPos.
+ */
+template<typename _t_backend, typename _t_reader>
+static inline void replayBlock(
+  BasicJFile<_t_backend>& file,
+  _t_reader& content,
+  int64_t& journalPos,
+  int type,
+  int64_t pos,
+  int64_t contentLength,
+  vector<unsigned char>& buff
+) {
+  switch (type) {
+  case kBlockTruncate:
+    file.f.truncate(pos);
+    break;
+  case kBlockCopy:
+    replayCopyBlock(file, content, journalPos, pos, contentLength);
+    break;
+  case kBlockBatch:
+    replayBatchBlock(file, content, journalPos, contentLength, buff);
+    break;
+  case kBlockData:
+    replayData(file, content, journalPos, pos, contentLength, buff);
+    break;
+  default:
+    throw runtime_error("Unknown journal block type");
+  }
+}
+
+/**
+ * Block content decompressed into memory, read like a backend.
+ */
+struct MemoryContent {
+  const vector<unsigned char>& data;
+
+  uint64_t read(int64_t pos, void* buff, uint64_t n) {
+    if (pos >= int64_t(data.size())) {
+      return 0;
+    }
+
+    const auto bytesRead = min<uint64_t>(n, data.size() - pos);
+    memcpy(buff, data.data() + pos, size_t(bytesRead));
+    return bytesRead;
+  }
+};
+
+/**
+ * Applies a compressed block. The content holds the uncompressed
+ * length (8 bytes), followed by the codec's output.
+ * Blocks are decompressed one at a time, so only one is held in memory.
+ */
+template<typename _t_backend>
+static inline void replayCompressedBlock(
+  BasicJFile<_t_backend>& file,
+  int64_t& journalPos,
+  int codec,
+  int type,
+  int64_t pos,
+  int64_t contentLength,
+  vector<unsigned char>& buff
+) {
+  if (contentLength < 8) {
+    throw runtime_error("Invalid compressed block");
+  }
+
+  // Checked before allocating, so a torn block cannot exhaust memory
+  const auto rawLength = readI64(file.jf, journalPos);
+  if (rawLength < 0 || rawLength > kMaxCompressedRawBytes) {
+    throw runtime_error("Invalid compressed block");
+  }
+
+  vector<unsigned char> compressed(static_cast<size_t>(contentLength - 8));
+  if (file.jf.read(journalPos, compressed.data(), compressed.size()) != compressed.size()) {
+    throw runtime_error("Unexpected EOF while flushing journal content");
+  }
 
-  const auto ch = fgetc(file.jf);
+  journalPos += compressed.size();
+
+  const auto start = chrono::steady_clock::now();
+  vector<unsigned char> raw(static_cast<size_t>(rawLength));
+  if (!decompressBlock(codec, compressed.data(), compressed.size(), raw.data(), raw.size())) {
+    throw runtime_error("Invalid compressed block");
+  }
+
+  file.stats.decompressNanos += uint64_t(
+    chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+
+  MemoryContent content{ raw };
+  int64_t rawPos = 0;
+  replayBlock(file, content, rawPos, type, pos, rawLength, buff);
+}
+
+template<typename _t_backend>
+static inline bool flushJournalFile(BasicJFile<_t_backend>& file) {
+  const auto ch = readFlag(file.jf);
   if (ch != kJournalReady) {
     return false;
   }
 
   bool flushed = false;
+  int64_t journalPos = kFlagBytes;
 
-  const auto version = fgeti32(file.jf);
-  assert(version == 1);
+  const auto version = readI32(file.jf, journalPos);
+  assert(version >= 1 && version <= kJournalVersion);
+
+  auto numBlocks = readI64(file.jf, journalPos);
+  if (version >= 2) {
+    // Original main file length, only needed for rollback
+    journalPos += 8;
+  }
 
-  auto numBlocks = fgeti64(file.jf);
   if (numBlocks > 0) {
+    vector<unsigned char> buff;
+
     while (numBlocks-- > 0) {
-      const auto blockLength = fgeti64(file.jf);
-      auto contentLength = blockLength - 16;
-      const auto pos = fgeti64(file.jf);
+      const auto blockLength = readI64(file.jf, journalPos);
+      auto pos = readI64(file.jf, journalPos);
+
+      int type = kBlockData;
+      int codec = kCodecNone;
+      if (version >= 3) {
+        unsigned char typeByte = 0;
+        if (file.jf.read(journalPos, &typeByte, 1) != 1) {
+          throw runtime_error("Unexpected EOF while flushing journal content");
+        }
 
-      if (contentLength < 0) {
-        throw runtime_error("Invalid content length");
-      } else if (contentLength == 0) {
-        continue;
+        type = typeByte & kBlockTypeMask;
+        codec = typeByte >> kBlockCodecShift;
+        journalPos++;
       }
 
-      fseek2(file.f, pos, SEEK_SET);
+      auto contentLength = blockLength - (version >= 3 ? 17 : 16);
 
-      while (contentLength-- > 0) {
-        const auto ch = fgetc(file.jf);
-        if (ch == EOF) {
-          throw runtime_error("Unexpected EOF while flushing journal content");
-        }
+      if (contentLength < 0) {
+        throw runtime_error("Invalid content length");
+      }
 
-        fputc2(ch, file.f);
+      if (codec != kCodecNone) {
+        replayCompressedBlock(file, journalPos, codec, type, pos, contentLength, buff);
+      } else {
+        replayBlock(file, file.jf, journalPos, type, pos, contentLength, buff);
       }
     }
 
-    fsync2(file.f);
+    file.f.sync();
     flushed = true;
   }
 
   // Mark the journal flush completed
-  fseek2(file.jf, 0, SEEK_SET);
-  fputc2(kJournalCleared, file.jf);
+  writeFlag(file.jf, kJournalCleared);
 
   file.lastPersistedPos = file.pos;
   file.lastPersistedMaxPos = file.maxPos;
+  file.hasDirectWrites = false;
   jfclear(file);
 
   return flushed;
 }
 
-static inline void jfseekEnd(JFile& file, int64_t offset) {
+/**
+ * Undo a journaling session that never got committed.
+ * Appended bytes go straight to the main file (see writeDirect),
+ * so the main file is truncated back to the length recorded in the journal header.
+ * Returns true if the main file was modified.
+ */
+template<typename _t_backend>
+static inline bool rollbackJournalFile(BasicJFile<_t_backend>& file) {
+  const auto ch = readFlag(file.jf);
+  if (ch != kJournaling) {
+    return false;
+  }
+
+  int64_t journalPos = kFlagBytes;
+  const auto version = readI32(file.jf, journalPos);
+  if (version < 2) {
+    // Version 1 never writes to the main file before committing
+    return false;
+  }
+
+  journalPos += 8;
+  const auto originalLength = readI64(file.jf, journalPos);
+
+  const bool truncated = file.f.size() > originalLength;
+  if (truncated) {
+    file.f.truncate(originalLength);
+    file.f.sync();
+  }
+
+  writeFlag(file.jf, kJournalCleared);
+
+  return truncated;
+}
+
+template<typename _t_backend>
+static inline void jfseekEnd(BasicJFile<_t_backend>& file, int64_t offset) {
   if (offset > 0) {
     throw runtime_error("Cannot seek past SEEK_END");
   }
@@ -81,7 +435,8 @@ static inline void jfseekEnd(JFile& file, int64_t offset) {
   file.pos = pos;
 }
 
-static inline void jfseekCur(JFile& file, int64_t offset) {
+template<typename _t_backend>
+static inline void jfseekCur(BasicJFile<_t_backend>& file, int64_t offset) {
   const auto pos = file.maxPos + offset;
   if (pos < 0) {
     throw runtime_error("Cannot seek to before zero");
@@ -94,7 +449,8 @@ static inline void jfseekCur(JFile& file, int64_t offset) {
   file.pos = pos;
 }
 
-static inline void jfseekSet(JFile& file, int64_t offset) {
+template<typename _t_backend>
+static inline void jfseekSet(BasicJFile<_t_backend>& file, int64_t offset) {
   if (offset < 0) {
     throw runtime_error("Cannot seek to before zero");
   }
@@ -106,123 +462,625 @@ static inline void jfseekSet(JFile& file, int64_t offset) {
   file.pos = offset;
 }
 
-static inline void initJournal(JFile& file, bool force = false) {
+/**
+ * The shared commit counter lives next to the journal.
+ */
+static inline fs::path seqlockPath(const fs::path& journalFilePath) {
+  auto path = journalFilePath;
+  path += ".seq";
+  return path;
+}
+
+/**
+ * True if the shared commit counter already holds the main file's
+ * current length, with no commit in progress.
+ */
+template<typename _t_backend>
+static inline bool isPublished(BasicJFile<_t_backend>& file) {
+  uint64_t sequence = 0;
+  int64_t committedLength = 0;
+  return JFSeqLock::peek(seqlockPath(file.journalPath), sequence, committedLength) &&
+    sequence != 0 && (sequence & 1) == 0 && committedLength == file.f.size();
+}
+
+template<typename _t_backend>
+static inline void initJournal(BasicJFile<_t_backend>& file, bool force = false) {
   if (!force && file.journalEndPos != 0) {
     return;
   }
 
-  int64_t numBytes = 0;
+  if (!file.jf.isOpen()) {
+    if (file.shareMode == SHARE_MODE_READ_ONLY) {
+      throw runtime_error("Cannot write to a file opened with SHARE_MODE_READ_ONLY");
+    }
 
-  fseek2(file.jf, 0, SEEK_SET);
+    file.jf = _t_backend::open(file.journalPath, "rb+", "wb+", SHARE_MODE_WRITING_SHARE_READ);
+  }
+
+  if (file.seqlockDeferred) {
+    // Still up to date (see jfopen): only writers change it, and this one holds the lock
+    file.seqlock = JFSeqLock::open(seqlockPath(file.journalPath), true);
+    file.seqlockDeferred = false;
+  }
+
+  unsigned char header[21];
   // Flag: 1 byte
-  fputc2(kJournaling, file.jf);
-  numBytes += 1;
+  header[0] = kJournaling;
   // Version: 4 bytes
-  fputi32(1, file.jf);
-  numBytes += 4;
+  encodeI32(kJournalVersion, header + 1);
   // Number of completed blocks: 8 bytes
-  fputi64(0, file.jf);
-  numBytes += 8;
-
-  file.journalEndPos = numBytes;
+  encodeI64(0, header + 5);
+  // Original main file length: 8 bytes
+  // Anything past this length was appended directly
+  // and must be truncated if the session is not committed.
+  encodeI64(file.lastPersistedMaxPos, header + 13);
+
+  file.jf.write(0, header, sizeof(header));
+  file.journalEndPos = sizeof(header);
 }
 
-static inline void initBlock(JFile& file) {
-  if (file.currentBlockLength != 0) {
-    return;
-  }
+/**
+ * Appends bytes to the current block of the journal.
+ */
+template<typename _t_backend>
+static inline void appendJournal(BasicJFile<_t_backend>& file, const unsigned char* buff, uint64_t n) {
+  file.jf.write(file.journalEndPos, buff, n);
+  file.currentBlockLength += n;
+  file.journalEndPos += n;
+}
 
+template<typename _t_backend>
+static inline void beginBlock(BasicJFile<_t_backend>& file, int type, int64_t pos) {
   file.journalBlockStartPos = file.journalEndPos;
 
+  unsigned char header[17];
   // Block length: 8 bytes
   // Set to zero for now. We will come back to set
   // this length when the block closes.
-  fputi64(0, file.jf);
-  file.currentBlockLength += 8;
+  encodeI64(0, header);
   // Content position: 8 bytes
-  fputi64(file.pos, file.jf);
-  file.currentBlockLength += 8;
+  // (for truncate blocks, this is the new file length)
+  encodeI64(pos, header + 8);
+  // Block type: 1 byte
+  header[16] = static_cast<unsigned char>(type);
+
+  appendJournal(file, header, sizeof(header));
+}
+
+template<typename _t_backend>
+static inline void initBlock(BasicJFile<_t_backend>& file) {
+  if (file.currentBlockLength != 0) {
+    return;
+  }
 
-  file.journalEndPos += file.currentBlockLength;
+  beginBlock(file, kBlockData, file.pos);
 }
 
-static inline void closeBlock(JFile& file) {
+template<typename _t_backend>
+static inline void endBlock(BasicJFile<_t_backend>& file) {
   if (file.currentBlockLength < 1) {
     return;
   }
 
-  fseek2(file.jf, file.journalBlockStartPos, SEEK_SET);
-  fputi64(file.currentBlockLength, file.jf);
+  unsigned char buff[8];
+  encodeI64(file.currentBlockLength, buff);
+  file.jf.write(file.journalBlockStartPos, buff, 8);
 
   file.numCompletedBlocks++;
-  fseek2(file.jf, kFlagBytes + kVersionBytes, SEEK_SET);
-  fputi64(file.numCompletedBlocks, file.jf);
+  encodeI64(file.numCompletedBlocks, buff);
+  file.jf.write(kFlagBytes + kVersionBytes, buff, 8);
 
-  // Note: don't use SEEK_END here, as the actual journal
-  // file size might be larger than journalEndPos
-  fseek2(file.jf, file.journalEndPos, SEEK_SET);
   file.currentBlockLength = 0;
 }
 
-static inline void incMainPos(JFile& file, int64_t count) {
+static inline bool overlaps(int64_t beginA, int64_t endA, int64_t beginB, int64_t endB) {
+  return beginA < endB && beginB < endA;
+}
+
+/**
+ * True if [begin, end) was journaled earlier in this delta session.
+ */
+template<typename _t_backend>
+static inline bool deltaJournaled(const BasicJFile<_t_backend>& file, int64_t begin, int64_t end) {
+  auto it = file.deltaJournaled.upper_bound(begin);
+  if (it != file.deltaJournaled.begin() && prev(it)->second > begin) {
+    return true;
+  }
+
+  return it != file.deltaJournaled.end() && it->first < end;
+}
+
+template<typename _t_backend>
+static inline void addDeltaJournaled(BasicJFile<_t_backend>& file, int64_t begin, int64_t end) {
+  auto it = file.deltaJournaled.upper_bound(begin);
+  if (it != file.deltaJournaled.begin() && prev(it)->second >= begin) {
+    --it;
+    begin = it->first;
+    end = max(end, it->second);
+    it = file.deltaJournaled.erase(it);
+  }
+
+  while (it != file.deltaJournaled.end() && it->first <= end) {
+    end = max(end, it->second);
+    it = file.deltaJournaled.erase(it);
+  }
+
+  file.deltaJournaled.emplace(begin, end);
+}
+
+/**
+ * A merged range of a batch: [pos, pos + length) holds the bytes at data[offset].
+ */
+struct BatchRange {
+  int64_t pos;
+  int64_t length;
+  uint64_t offset;
+};
+
+/**
+ * Appends a complete block whose content is already in memory,
+ * compressed with the file's codec unless that does not make it smaller.
+ * The current block must be closed.
+ */
+template<typename _t_backend>
+static inline void appendBlock(
+  BasicJFile<_t_backend>& file,
+  int type,
+  int64_t pos,
+  const unsigned char* content,
+  uint64_t n
+) {
+  auto& block = file.blockBuffer;
+  block.resize(17);
+
+  int codec = kCodecNone;
+  if (file.codec != kCodecNone && n >= kMinCompressBytes) {
+    const auto start = chrono::steady_clock::now();
+
+    // Uncompressed length: 8 bytes
+    block.resize(17 + 8);
+    encodeI64(int64_t(n), block.data() + 17);
+    compressBlock(file.codec, content, n, block);
+
+    file.stats.compressNanos += uint64_t(
+      chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    file.stats.compressInputBytes += n;
+
+    if (block.size() - 17 < n) {
+      codec = file.codec;
+    } else {
+      block.resize(17);
+    }
+
+    file.stats.compressOutputBytes += block.size() == 17 ? n : block.size() - 17;
+  }
+
+  if (codec == kCodecNone) {
+    block.insert(block.end(), content, content + n);
+  }
+
+  // Block header. endBlock sets the length, as for any other block.
+  encodeI64(0, block.data());
+  encodeI64(pos, block.data() + 8);
+  block[16] = static_cast<unsigned char>(type | (codec << kBlockCodecShift));
+
+  file.journalBlockStartPos = file.journalEndPos;
+  appendJournal(file, block.data(), block.size());
+  endBlock(file);
+}
+
+/**
+ * Journals ranges (sorted, disjoint) as one batch block.
+ * The bytes of each range are at data + range.offset.
+ */
+template<typename _t_backend>
+static inline void journalBatchBlock(
+  BasicJFile<_t_backend>& file,
+  const vector<BatchRange>& ranges,
+  const unsigned char* data
+) {
+  vector<unsigned char> content(8 + kMaxVarintBytes * (1 + 2 * ranges.size()));
+
+  // Table
+  size_t tableEnd = 8;
+  tableEnd += encodeVarint(ranges.size(), content.data() + tableEnd);
+
+  int64_t end = 0;
+  uint64_t dataBytes = 0;
+  for (const auto& range : ranges) {
+    tableEnd += encodeVarint(uint64_t(range.pos - end), content.data() + tableEnd);
+    tableEnd += encodeVarint(uint64_t(range.length), content.data() + tableEnd);
+    end = range.pos + range.length;
+    dataBytes += range.length;
+  }
+
+  // Table length: 8 bytes
+  encodeI64(int64_t(tableEnd - 8), content.data());
+
+  // Data section
+  content.resize(tableEnd + dataBytes);
+  auto out = content.data() + tableEnd;
+  for (const auto& range : ranges) {
+    memcpy(out, data + range.offset, size_t(range.length));
+    out += range.length;
+  }
+
+  appendBlock(file, kBlockBatch, ranges.front().pos, content.data(), content.size());
+
+  if (file.deltaMode) {
+    for (const auto& range : ranges) {
+      addDeltaJournaled(file, range.pos, range.pos + range.length);
+    }
+  }
+
+  file.maxPos = max(file.maxPos, end);
+}
+
+/**
+ * Journals ranges (sorted, disjoint) as batch blocks.
+ * The bytes of each range are at data + range.offset.
+ * With a codec, every block holds at most kMaxCompressedDataBytes of data,
+ * since replay decompresses a block in one piece.
+ * The current block must be closed.
+ */
+template<typename _t_backend>
+static inline void journalBatch(
+  BasicJFile<_t_backend>& file,
+  const vector<BatchRange>& ranges,
+  const unsigned char* data
+) {
+  if (file.codec == kCodecNone) {
+    journalBatchBlock(file, ranges, data);
+    return;
+  }
+
+  vector<BatchRange> group;
+  int64_t groupBytes = 0;
+  for (auto range : ranges) {
+    while (range.length > 0) {
+      const auto length = min(range.length, kMaxCompressedDataBytes - groupBytes);
+      group.push_back({ range.pos, length, range.offset });
+      groupBytes += length;
+      range.pos += length;
+      range.offset += uint64_t(length);
+      range.length -= length;
+
+      if (groupBytes == kMaxCompressedDataBytes) {
+        journalBatchBlock(file, group, data);
+        group.clear();
+        groupBytes = 0;
+      }
+    }
+  }
+
+  if (!group.empty()) {
+    journalBatchBlock(file, group, data);
+  }
+}
+
+/**
+ * Finds the ranges of the pending bytes that have to be journaled in delta mode:
+ * the ones that differ from the main file, and the ones journaled before.
+ */
+template<typename _t_backend>
+static inline void deltaRanges(BasicJFile<_t_backend>& file, vector<pair<uint64_t, uint64_t>>& kept) {
+  const auto start = chrono::steady_clock::now();
+  const auto n = file.pendingBuffer.size();
+
+  // Delta writes are all below the committed end of file, which the session has not touched
+  vector<unsigned char> current(n);
+  const auto bytesRead = file.f.read(file.pendingPos, current.data(), n);
+
+  vector<pair<uint64_t, uint64_t>> ranges;
+  if (bytesRead == n) {
+    diffRanges(file.pendingBuffer.data(), current.data(), n, kDeltaMinEqualRun, ranges);
+  } else {
+    ranges.emplace_back(0, n);
+  }
+
+  // Unchanged runs can only be dropped if nothing else was journaled for them
+  uint64_t end = 0;
+  for (const auto& range : ranges) {
+    if (range.first > end && !deltaJournaled(file, file.pendingPos + end, file.pendingPos + range.first)) {
+      kept.push_back(range);
+    } else if (kept.empty()) {
+      kept.emplace_back(0, range.second);
+    } else {
+      kept.back().second = range.second;
+    }
+
+    end = range.second;
+  }
+
+  if (end < n && deltaJournaled(file, file.pendingPos + end, file.pendingPos + n)) {
+    if (kept.empty()) {
+      kept.emplace_back(0, n);
+    } else {
+      kept.back().second = n;
+    }
+  }
+
+  file.stats.deltaCompareNanos += uint64_t(
+    chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+  file.stats.deltaComparedBytes += n;
+}
+
+/**
+ * Journals the pending bytes (see appendPending).
+ * In delta mode, the runs that match the main file are left out,
+ * and the changed ranges go into one batch block.
+ */
+template<typename _t_backend>
+static inline void flushPending(BasicJFile<_t_backend>& file) {
+  if (file.pendingBuffer.empty()) {
+    return;
+  }
+
+  const auto n = file.pendingBuffer.size();
+
+  vector<pair<uint64_t, uint64_t>> kept;
+  if (file.deltaMode && !file.fullyJournaled) {
+    deltaRanges(file, kept);
+  } else {
+    kept.emplace_back(0, n);
+  }
+
+  vector<BatchRange> batch;
+  uint64_t keptBytes = 0;
+  for (const auto& range : kept) {
+    const auto length = int64_t(range.second - range.first);
+    batch.push_back({ file.pendingPos + int64_t(range.first), length, range.first });
+    keptBytes += length;
+  }
+
+  if (file.deltaMode && !file.fullyJournaled) {
+    file.stats.deltaDroppedBytes += n - keptBytes;
+  }
+
+  if (batch.size() == 1) {
+    appendBlock(file, kBlockData, batch[0].pos, file.pendingBuffer.data() + batch[0].offset, keptBytes);
+    if (file.deltaMode) {
+      addDeltaJournaled(file, batch[0].pos, batch[0].pos + batch[0].length);
+    }
+  } else if (!batch.empty()) {
+    journalBatch(file, batch, file.pendingBuffer.data());
+  }
+
+  file.pendingBuffer.clear();
+}
+
+template<typename _t_backend>
+static inline void closeBlock(BasicJFile<_t_backend>& file) {
+  flushPending(file);
+  endBlock(file);
+}
+
+template<typename _t_backend>
+static inline void incMainPos(BasicJFile<_t_backend>& file, int64_t count) {
   file.pos += count;
   if (file.pos > file.maxPos) {
     file.maxPos = file.pos;
   }
 }
 
-static inline bool isWriting(const JFile& file) {
+template<typename _t_backend>
+static inline bool isWriting(const BasicJFile<_t_backend>& file) {
   return file.journalEndPos != 0 || file.currentBlockLength != 0;
 }
 
-JFile jfopen(
+template<typename _t_backend>
+static inline void markDirty(BasicJFile<_t_backend>& file, int64_t begin, int64_t end) {
+  if (file.copySourceEnd > file.copySourceBegin &&
+    overlaps(begin, end, file.copySourceBegin, file.copySourceEnd)) {
+    throw runtime_error("Cannot modify the source range of a pending jfcopyrange before flushing");
+  }
+
+  if (file.dirtyEnd <= file.dirtyBegin) {
+    file.dirtyBegin = begin;
+    file.dirtyEnd = end;
+  } else {
+    file.dirtyBegin = min(file.dirtyBegin, begin);
+    file.dirtyEnd = max(file.dirtyEnd, end);
+  }
+}
+
+/**
+ * Writes bytes past lastPersistedMaxPos straight into the main file.
+ * They cannot corrupt committed data, so only the original length
+ * (in the journal header) is needed to undo them.
+ */
+template<typename _t_backend>
+static inline void writeDirect(const unsigned char* buff, uint64_t n, BasicJFile<_t_backend>& file) {
+  closeBlock(file);
+
+  if (!file.hasDirectWrites) {
+    // The original length must be durable before the main file grows,
+    // otherwise recovery could not tell which bytes to drop.
+    file.jf.sync();
+    file.hasDirectWrites = true;
+  }
+
+  file.f.write(file.pos, buff, n);
+  incMainPos(file, n);
+}
+
+/**
+ * Holds back journaled bytes at the current position until the block closes,
+ * for delta journaling or compression, which need the whole block in memory.
+ */
+template<typename _t_backend>
+static inline void appendPending(BasicJFile<_t_backend>& file, const unsigned char* buff, uint64_t n) {
+  auto pos = file.pos;
+  while (n > 0) {
+    if (file.pendingBuffer.size() == kPendingBufferBytes ||
+      (!file.pendingBuffer.empty() && file.pendingPos + int64_t(file.pendingBuffer.size()) != pos)) {
+      flushPending(file);
+    }
+
+    if (file.pendingBuffer.empty()) {
+      endBlock(file);
+      file.pendingPos = pos;
+    }
+
+    const auto chunk = min<uint64_t>(n, kPendingBufferBytes - file.pendingBuffer.size());
+    file.pendingBuffer.insert(file.pendingBuffer.end(), buff, buff + chunk);
+
+    buff += chunk;
+    n -= chunk;
+    pos += chunk;
+  }
+}
+
+/**
+ * Writes n bytes at the current position.
+ * Overwrites of committed data go through the journal,
+ * anything past the committed end of file is appended directly.
+ */
+template<typename _t_backend>
+static inline void writeBytes(const unsigned char* buff, uint64_t n, BasicJFile<_t_backend>& file) {
+  initJournal(file);
+
+  const auto journalLimit = file.fullyJournaled ? INT64_MAX : max(file.lastPersistedMaxPos, file.savepointMaxPos);
+
+  uint64_t journaled = 0;
+  if (file.pos < journalLimit) {
+    journaled = min(n, uint64_t(journalLimit - file.pos));
+    markDirty(file, file.pos, file.pos + journaled);
+
+    if ((file.deltaMode && !file.fullyJournaled) || file.codec != kCodecNone) {
+      appendPending(file, buff, journaled);
+    } else {
+      initBlock(file);
+      appendJournal(file, buff, journaled);
+    }
+
+    incMainPos(file, journaled);
+  }
+
+  if (journaled < n) {
+    writeDirect(buff + journaled, n - journaled, file);
+  }
+}
+
+/**
+ * Size of the main file as of the last commit.
+ */
+template<typename _t_backend>
+static inline int64_t mainFileSize(BasicJFile<_t_backend>& file) {
+  if (isSharedReader(file)) {
+    const auto sequence = file.seqlock.readBegin();
+    if (sequence != 0) {
+      return file.seqlock.committedLength();
+    }
+  }
+
+  return file.f.size();
+}
+
+/**
+ * Closes a file that failed to open. Unlike jfclose, it keeps the journal,
+ * so the next jfopen retries the recovery.
+ */
+template<typename _t_backend>
+static inline void closeFailedOpen(BasicJFile<_t_backend>& file) {
+  file.f.close();
+  file.jf.close();
+  file.seqlock.close();
+}
+
+template<typename _t_backend>
+BasicJFile<_t_backend> jfopen(
   const fs::path& mainFilePath,
   const fs::path& journalFilePath,
   const string& mainFileModeA,
   const string& mainFileModeB,
   int shareMode
 ) {
-  JFile file{};
-  file.f = fopen2(mainFilePath, mainFileModeA, mainFileModeB, shareMode);
-
-  if (shareMode == SHARE_MODE_READ_ONLY) {
-    file.jf = nullptr;
-  } else {
-    try {
-      file.jf = fopen2(journalFilePath, "rb+", "wb+", SHARE_MODE_WRITING_SHARE_READ);
-    } catch (runtime_error&) {
-      jfclose(file);
-      throw;
+  BasicJFile<_t_backend> file{};
+  file.path = mainFilePath;
+  file.journalPath = journalFilePath;
+  file.shareMode = shareMode;
+  file.f = _t_backend::open(mainFilePath, mainFileModeA, mainFileModeB, shareMode);
+
+  if (shareMode != SHARE_MODE_READ_ONLY) {
+    // A missing or empty journal is the clean shutdown marker left by jfclose:
+    // there is nothing to recover, so the journal is only opened once writing starts.
+    // The main file lock is held, so no other writer can start a journal meanwhile.
+    const auto clean = _t_backend::isEmpty(journalFilePath);
+    if (!clean) {
+      try {
+        file.jf = _t_backend::open(journalFilePath, "rb+", "wb+", SHARE_MODE_WRITING_SHARE_READ);
+      } catch (runtime_error&) {
+        closeFailedOpen(file);
+        throw;
+      }
     }
 
-    if (flushJournalFile(file)) {
-      // We have modified the main file, we want to close and open it again.
-      fclose(file.f);
+    if (_t_backend::kShared && shareMode == SHARE_MODE_WRITING_SHARE_READ && clean && isPublished(file)) {
+      // Readers already see the current file, so mapping the commit counter can wait for the first write
+      file.seqlockDeferred = true;
+    } else if (_t_backend::kShared && shareMode == SHARE_MODE_WRITING_SHARE_READ) {
       try {
-        file.f = fopen2(mainFilePath, mainFileModeA, mainFileModeB, shareMode);
+        file.seqlock = JFSeqLock::open(seqlockPath(journalFilePath), true);
       } catch (runtime_error&) {
-        jfclose(file);
+        closeFailedOpen(file);
         throw;
       }
+
+      // Readers wait while recovery replays or rolls back the journal
+      file.seqlock.beginCommit();
+    }
+
+    try {
+      if (file.jf.isOpen() && (flushJournalFile(file) || rollbackJournalFile(file))) {
+        // We have modified the main file, we want to close and open it again.
+        file.f.close();
+        file.f = _t_backend::open(mainFilePath, mainFileModeA, mainFileModeB, shareMode);
+      }
+    } catch (...) {
+      if (file.seqlock.isOpen()) {
+        // Readers must not keep waiting for a recovery that will not finish
+        file.seqlock.publish(file.seqlock.committedLength());
+      }
+
+      closeFailedOpen(file);
+      throw;
     }
+  } else if (_t_backend::kShared && !journalFilePath.empty()) {
+    file.seqlock = JFSeqLock::open(seqlockPath(journalFilePath), false);
   }
 
-  file.pos = ftell2(file.f);
+  file.pos = 0;
+  file.maxPos = mainFileSize(file);
 
-  // determine the maximum pos (file length)
-  fseek2(file.f, 0, SEEK_END);
-  file.maxPos = ftell2(file.f);
+  file.lastPersistedPos = file.pos;
+  file.lastPersistedMaxPos = file.maxPos;
 
-  fseek2(file.f, file.pos, SEEK_SET);
+  if (file.seqlock.isOpen() && shareMode != SHARE_MODE_READ_ONLY) {
+    file.seqlock.publish(file.maxPos);
+  }
 
   return file;
 }
 
-int64_t jfseek(JFile& file, int64_t offset, int origin) {
+template<typename _t_backend>
+int64_t jfseek(BasicJFile<_t_backend>& file, int64_t offset, int origin) {
   if (!isWriting(file)) {
     // read mode
-    fseek2(file.f, offset, origin);
-    file.pos = ftell2(file.f);
+    int64_t pos = offset;
+    if (origin == SEEK_CUR) {
+      pos += file.pos;
+    } else if (origin == SEEK_END) {
+      pos += mainFileSize(file);
+    } else if (origin != SEEK_SET) {
+      throw runtime_error("jfseek: origin must be either SEEK_SET, SEEK_CUR, or SEEK_END");
+    }
+
+    if (pos < 0) {
+      throw runtime_error("Cannot seek to before zero");
+    }
+
+    file.pos = pos;
     return file.pos;
   }
 
@@ -247,168 +1105,533 @@ int64_t jfseek(JFile& file, int64_t offset, int origin) {
   return file.pos;
 }
 
-int64_t jftell(const JFile & file) {
+template<typename _t_backend>
+int64_t jftell(const BasicJFile<_t_backend>& file) {
   return file.pos;
 }
 
-void jfputc(int ch, JFile& file) {
-  initJournal(file);
-  initBlock(file);
+template<typename _t_backend>
+void jfputc(int ch, BasicJFile<_t_backend>& file) {
+  const auto c = static_cast<unsigned char>(ch);
+  writeBytes(&c, 1, file);
+}
 
-  fputc2(ch, file.jf);
-  file.currentBlockLength++;
-  file.journalEndPos++;
-  incMainPos(file, 1);
+template<typename _t_backend>
+void jfputs(const char* str, BasicJFile<_t_backend>& file) {
+  writeBytes(reinterpret_cast<const unsigned char*>(str), strlen(str), file);
 }
 
-void jfputs(const char* str, JFile& file) {
-  initJournal(file);
-  initBlock(file);
+template<typename _t_backend>
+void jfputs(const char* str, uint64_t n, BasicJFile<_t_backend>& file) {
+  writeBytes(reinterpret_cast<const unsigned char*>(str), n, file);
+}
 
-  const auto count = fputs2(str, file.jf);
+template<typename _t_backend>
+void jfputs(const unsigned char* str, uint64_t n, BasicJFile<_t_backend>& file) {
+  writeBytes(str, n, file);
+}
 
-  file.currentBlockLength += count;
-  file.journalEndPos += count;
-  incMainPos(file, count);
+template<typename _t_backend>
+void jfputi32(int32_t i32, BasicJFile<_t_backend>& file) {
+  unsigned char buff[4];
+  encodeI32(i32, buff);
+  writeBytes(buff, 4, file);
 }
 
-void jfputs(const char* str, uint64_t n, JFile& file) {
-  initJournal(file);
-  initBlock(file);
+template<typename _t_backend>
+void jfputi64(int64_t i64, BasicJFile<_t_backend>& file) {
+  unsigned char buff[8];
+  encodeI64(i64, buff);
+  writeBytes(buff, 8, file);
+}
 
-  fputs2(str, n, file.jf);
+template<typename _t_backend>
+void jfputvarint(uint64_t i, BasicJFile<_t_backend>& file) {
+  unsigned char buff[kMaxVarintBytes];
+  writeBytes(buff, encodeVarint(i, buff), file);
+}
 
-  file.currentBlockLength += n;
-  file.journalEndPos += n;
-  incMainPos(file, n);
+template<typename _t_backend>
+void jfputsvarint(int64_t i, BasicJFile<_t_backend>& file) {
+  jfputvarint(zigzagEncode(i), file);
+}
+
+template<typename _t_backend>
+void jfputrecord(const char* str, uint64_t n, BasicJFile<_t_backend>& file) {
+  jfputrecord(reinterpret_cast<const unsigned char*>(str), n, file);
+}
+
+template<typename _t_backend>
+void jfputrecord(const unsigned char* str, uint64_t n, BasicJFile<_t_backend>& file) {
+  jfputvarint(n, file);
+  writeBytes(str, n, file);
 }
 
-void jfputs(const unsigned char* str, uint64_t n, JFile & file) {
+/**
+ * Sorts the writes and merges the overlapping or adjacent ones into ranges.
+ * The merged bytes are laid out back to back in data, in range order.
+ * Writes are copied in list order, so later writes win where they overlap.
+ */
+static inline void mergeWrites(
+  const JFWrite* writes,
+  uint64_t n,
+  vector<BatchRange>& ranges,
+  vector<unsigned char>& data
+) {
+  vector<uint64_t> order;
+  order.reserve(n);
+  for (uint64_t i = 0; i < n; i++) {
+    if (writes[i].pos < 0) {
+      throw runtime_error("jfputbatch: cannot write before zero");
+    }
+
+    if (writes[i].length > 0) {
+      order.push_back(i);
+    }
+  }
+
+  sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+    return writes[a].pos < writes[b].pos;
+  });
+
+  // Range of every write, by list index
+  vector<uint64_t> rangeOf(n);
+  uint64_t totalBytes = 0;
+
+  for (const auto i : order) {
+    const auto begin = writes[i].pos;
+    const auto end = begin + int64_t(writes[i].length);
+
+    if (ranges.empty() || begin > ranges.back().pos + ranges.back().length) {
+      if (!ranges.empty()) {
+        totalBytes += ranges.back().length;
+      }
+
+      ranges.push_back({ begin, end - begin, totalBytes });
+    } else {
+      auto& range = ranges.back();
+      range.length = max(range.length, end - range.pos);
+    }
+
+    rangeOf[i] = ranges.size() - 1;
+  }
+
+  if (!ranges.empty()) {
+    totalBytes += ranges.back().length;
+  }
+
+  data.resize(size_t(totalBytes));
+  for (uint64_t i = 0; i < n; i++) {
+    if (writes[i].length > 0) {
+      const auto& range = ranges[rangeOf[i]];
+      memcpy(data.data() + range.offset + (writes[i].pos - range.pos), writes[i].data, size_t(writes[i].length));
+    }
+  }
+}
+
+template<typename _t_backend>
+void jfputbatch(const JFWrite* writes, uint64_t n, BasicJFile<_t_backend>& file) {
+  vector<BatchRange> ranges;
+  vector<unsigned char> data;
+  mergeWrites(writes, n, ranges, data);
+
+  if (ranges.empty()) {
+    return;
+  }
+
+  int64_t end = file.maxPos;
+  for (const auto& range : ranges) {
+    if (range.pos > end) {
+      throw runtime_error("jfputbatch: cannot write past the end of file");
+    }
+
+    end = max(end, range.pos + range.length);
+  }
+
   initJournal(file);
-  initBlock(file);
 
-  fputs2(str, n, file.jf);
+  // Like writeBytes: committed content is journaled, the rest is appended directly
+  const auto journalLimit = file.fullyJournaled ? INT64_MAX : max(file.lastPersistedMaxPos, file.savepointMaxPos);
 
-  file.currentBlockLength += n;
-  file.journalEndPos += n;
-  incMainPos(file, n);
+  vector<BatchRange> journaled;
+  vector<BatchRange> direct;
+  for (const auto& range : ranges) {
+    const auto split = min(range.length, max<int64_t>(journalLimit - range.pos, 0));
+    if (split > 0) {
+      journaled.push_back({ range.pos, split, range.offset });
+    }
+
+    if (split < range.length) {
+      direct.push_back({ range.pos + split, range.length - split, range.offset + split });
+    }
+  }
+
+  if (!journaled.empty()) {
+    closeBlock(file);
+    markDirty(file, journaled.front().pos, journaled.back().pos + journaled.back().length);
+    journalBatch(file, journaled, data.data());
+  }
+
+  const auto pos = file.pos;
+  for (const auto& range : direct) {
+    file.pos = range.pos;
+    writeDirect(data.data() + range.offset, uint64_t(range.length), file);
+  }
+
+  file.pos = pos;
 }
 
-void jfputi32(int32_t i32, JFile& file) {
+/**
+ * Journals a copy block. srcPath is empty when copying within the main file.
+ */
+template<typename _t_backend>
+static inline void journalCopy(
+  BasicJFile<_t_backend>& file,
+  int64_t dstPos,
+  int64_t srcPos,
+  int64_t count,
+  const string& srcPath
+) {
+  if (dstPos < 0 || dstPos > file.maxPos) {
+    throw runtime_error("jfcopyrange: cannot copy past the end of file");
+  }
+
   initJournal(file);
-  initBlock(file);
+  closeBlock(file);
+  markDirty(file, dstPos, dstPos + count);
+  file.fullyJournaled = true;
+
+  unsigned char buff[16];
+  encodeI64(srcPos, buff);
+  encodeI64(count, buff + 8);
+
+  beginBlock(file, kBlockCopy, dstPos);
+  appendJournal(file, buff, 16);
+  appendJournal(file, reinterpret_cast<const unsigned char*>(srcPath.data()), srcPath.size());
+  closeBlock(file);
+
+  file.maxPos = max(file.maxPos, dstPos + count);
+}
+
+template<typename _t_backend>
+void jfcopyrange(
+  BasicJFile<_t_backend>& file,
+  int64_t dstPos,
+  const BasicJFile<_t_backend>& src,
+  int64_t srcPos,
+  int64_t count
+) {
+  if (&src == &file) {
+    jfcopyrange(file, dstPos, srcPos, count);
+    return;
+  }
+
+  if (count < 0 || srcPos < 0 || srcPos + count > src.lastPersistedMaxPos) {
+    throw runtime_error("jfcopyrange: source range is outside of the committed source file");
+  }
+
+  if (src.path.empty()) {
+    throw runtime_error("jfcopyrange: source file has no path");
+  }
+
+  if (src.shareMode == SHARE_MODE_EXCLUSIVE) {
+    // Replay opens the source read-only, which the exclusive lock would refuse
+    throw runtime_error("jfcopyrange: source file is opened exclusively");
+  }
+
+  // Recovery may run from another working directory. Memory files do not outlive the process.
+  const auto srcPath = _t_backend::kShared ? fs::absolute(src.path).string() : src.path.string();
+  journalCopy(file, dstPos, srcPos, count, srcPath);
+}
+
+template<typename _t_backend>
+void jfcopyrange(BasicJFile<_t_backend>& file, int64_t dstPos, int64_t srcPos, int64_t count) {
+  if (count < 0 || srcPos < 0 || srcPos + count > file.lastPersistedMaxPos) {
+    throw runtime_error("jfcopyrange: source range is outside of the committed file");
+  }
 
-  fputi32(i32, file.jf);
+  if (overlaps(srcPos, srcPos + count, dstPos, dstPos + count)) {
+    throw runtime_error("jfcopyrange: source and destination ranges overlap");
+  }
+
+  if (file.dirtyEnd > file.dirtyBegin &&
+    overlaps(srcPos, srcPos + count, file.dirtyBegin, file.dirtyEnd)) {
+    throw runtime_error("jfcopyrange: source range was modified in this session");
+  }
+
+  journalCopy(file, dstPos, srcPos, count, "");
 
-  file.currentBlockLength += 4;
-  file.journalEndPos += 4;
-  incMainPos(file, 4);
+  if (file.copySourceEnd <= file.copySourceBegin) {
+    file.copySourceBegin = srcPos;
+    file.copySourceEnd = srcPos + count;
+  } else {
+    file.copySourceBegin = min(file.copySourceBegin, srcPos);
+    file.copySourceEnd = max(file.copySourceEnd, srcPos + count);
+  }
 }
 
-void jfputi64(int64_t i64, JFile& file) {
+template<typename _t_backend>
+void jftruncate(BasicJFile<_t_backend>& file, int64_t length) {
+  if (length < 0 || length > file.maxPos) {
+    throw runtime_error("jftruncate: length must be between zero and the file size");
+  }
+
   initJournal(file);
-  initBlock(file);
+  closeBlock(file);
+  markDirty(file, length, INT64_MAX);
+  file.fullyJournaled = true;
 
-  fputi64(i64, file.jf);
+  beginBlock(file, kBlockTruncate, length);
+  closeBlock(file);
 
-  file.currentBlockLength += 8;
-  file.journalEndPos += 8;
-  incMainPos(file, 8);
+  file.maxPos = length;
+  file.pos = min(file.pos, length);
 }
 
-int jfgetc(JFile& file) {
+template<typename _t_backend>
+int jfgetc(BasicJFile<_t_backend>& file) {
   if (isWriting(file)) {
     return EOF;
   }
 
-  const int ch = fgetc(file.f);
+  unsigned char ch = 0;
+  if (readMainFile(file, file.pos, &ch, 1) != 1) {
+    return EOF;
+  }
+
   file.pos++;
 
   return ch;
 }
 
-int64_t jfgetn(char* s, uint64_t count, JFile& file) {
+template<typename _t_backend>
+int64_t jfgetn(char* s, uint64_t count, BasicJFile<_t_backend>& file) {
   if (isWriting(file)) {
     return EOF;
   }
-    
-  const auto bytesRead = fgetn(s, count, file.f);
+
+  const auto bytesRead = readMainFile(file, file.pos, s, count);
   file.pos += bytesRead;
 
   return bytesRead;
 }
 
-int64_t jfgetn(unsigned char * s, uint64_t count, JFile & file) {
+template<typename _t_backend>
+int64_t jfgetn(unsigned char* s, uint64_t count, BasicJFile<_t_backend>& file) {
   if (isWriting(file)) {
     return EOF;
   }
 
-  const auto bytesRead = fgetn(s, count, file.f);
+  const auto bytesRead = readMainFile(file, file.pos, s, count);
   file.pos += bytesRead;
 
   return bytesRead;
 }
 
-int64_t jfgetn(std::string&s, uint64_t count, JFile & file) {
+/**
+ * Appends at most count bytes to the container.
+ */
+template<typename _t_backend, typename _t_container>
+static inline int64_t jfgetnv(_t_container& buff, uint64_t count, BasicJFile<_t_backend>& file) {
   if (isWriting(file)) {
     return EOF;
   }
 
-  const auto bytesRead = fgetnv(s, count, file.f);
+  const auto oldSize = buff.size();
+  buff.resize(oldSize + count);
+
+  const auto bytesRead = readMainFile(file, file.pos, &buff[oldSize], count);
+  buff.resize(oldSize + bytesRead);
   file.pos += bytesRead;
 
   return bytesRead;
 }
 
-int64_t jfgetn(std::vector<unsigned char>& buff, uint64_t count, JFile & file) {
-  if (isWriting(file)) {
-    return EOF;
-  }
-
-  const auto bytesRead = fgetnv(buff, count, file.f);
-  file.pos += bytesRead;
+template<typename _t_backend>
+int64_t jfgetn(std::string& s, uint64_t count, BasicJFile<_t_backend>& file) {
+  return jfgetnv(s, count, file);
+}
 
-  return bytesRead;
+template<typename _t_backend>
+int64_t jfgetn(std::vector<unsigned char>& buff, uint64_t count, BasicJFile<_t_backend>& file) {
+  return jfgetnv(buff, count, file);
 }
 
-int32_t jfgeti32(JFile& file) {
+template<typename _t_backend>
+int32_t jfgeti32(BasicJFile<_t_backend>& file) {
   if (isWriting(file)) {
     throw runtime_error("jfgeti32: cannot read during writing mode");
   }
 
-  const auto n = fgeti32(file.f);
+  unsigned char buff[4];
+  if (readMainFile(file, file.pos, buff, 4) != 4) {
+    throw runtime_error("Failed to read int32");
+  }
+
   file.pos += 4;
-  return n;
+  return int32_t(decodeInt(buff, 4));
 }
 
-int64_t jfgeti64(JFile & file) {
+template<typename _t_backend>
+int64_t jfgeti64(BasicJFile<_t_backend>& file) {
   if (isWriting(file)) {
-    throw runtime_error("jfgeti32: cannot read during writing mode");
+    throw runtime_error("jfgeti64: cannot read during writing mode");
+  }
+
+  unsigned char buff[8];
+  if (readMainFile(file, file.pos, buff, 8) != 8) {
+    throw runtime_error("Failed to read int64");
   }
 
-  const auto n = fgeti64(file.f);
   file.pos += 8;
-  return n;
+  return decodeInt(buff, 8);
 }
 
-void jfflush(JFile& file) {
+/**
+ * Reads the varint at jftell() position. Returns false at the end of the file.
+ */
+template<typename _t_backend>
+static inline bool readVarint(BasicJFile<_t_backend>& file, uint64_t& value) {
+  unsigned char buff[kMaxVarintBytes];
+  const auto bytesRead = readMainFile(file, file.pos, buff, kMaxVarintBytes);
+  if (bytesRead == 0) {
+    return false;
+  }
+
+  const auto used = decodeVarint(buff, bytesRead, value);
+  if (used == 0) {
+    throw runtime_error("Failed to read varint");
+  }
+
+  file.pos += used;
+  return true;
+}
+
+template<typename _t_backend>
+uint64_t jfgetvarint(BasicJFile<_t_backend>& file) {
+  if (isWriting(file)) {
+    throw runtime_error("jfgetvarint: cannot read during writing mode");
+  }
+
+  uint64_t value = 0;
+  if (!readVarint(file, value)) {
+    throw runtime_error("Failed to read varint");
+  }
+
+  return value;
+}
+
+template<typename _t_backend>
+int64_t jfgetsvarint(BasicJFile<_t_backend>& file) {
+  if (isWriting(file)) {
+    throw runtime_error("jfgetsvarint: cannot read during writing mode");
+  }
+
+  return zigzagDecode(jfgetvarint(file));
+}
+
+template<typename _t_backend, typename _t_container>
+static inline int64_t jfgetrecordv(_t_container& buff, BasicJFile<_t_backend>& file) {
+  if (isWriting(file)) {
+    throw runtime_error("jfgetrecord: cannot read during writing mode");
+  }
+
+  const auto recordPos = file.pos;
+  uint64_t length = 0;
+  if (!readVarint(file, length)) {
+    return EOF;
+  }
+
+  // A corrupt length must not turn into a huge allocation. maxPos can lag
+  // behind the commits of another process, so check the current size before failing.
+  const auto fits = [&](int64_t size) { return length <= uint64_t(max<int64_t>(size - file.pos, 0)); };
+  if (!fits(file.maxPos) && !fits(mainFileSize(file))) {
+    file.pos = recordPos;
+    throw runtime_error("Failed to read record: length past the end of the file");
+  }
+
+  const auto oldSize = buff.size();
+  if (uint64_t(jfgetnv(buff, length, file)) != length) {
+    buff.resize(oldSize);
+    file.pos = recordPos;
+    throw runtime_error("Failed to read record");
+  }
+
+  return int64_t(length);
+}
+
+template<typename _t_backend>
+int64_t jfgetrecord(std::string& s, BasicJFile<_t_backend>& file) {
+  return jfgetrecordv(s, file);
+}
+
+template<typename _t_backend>
+int64_t jfgetrecord(std::vector<unsigned char>& buff, BasicJFile<_t_backend>& file) {
+  return jfgetrecordv(buff, file);
+}
+
+template<typename _t_backend>
+void jfflush(BasicJFile<_t_backend>& file) {
   if (file.journalEndPos == 0) {
+    // Nothing to commit, but the session still ends with its savepoints
+    file.savepoints.clear();
+    file.savepointMaxPos = 0;
     return;
   }
 
   closeBlock(file);
-  fseek2(file.jf, 0, SEEK_SET);
-  fputc2(kJournalReady, file.jf);
-  fsync2(file.jf);
 
-  flushJournalFile(file);
+  if (file.hasDirectWrites) {
+    // Appended bytes are part of the commit,
+    // so they must hit the disk before the journal is marked ready.
+    file.f.sync();
+  }
+
+  writeFlag(file.jf, kJournalReady);
+  file.jf.sync();
 
-  // Go back to where the main file was
-  fseek2(file.f, file.pos, SEEK_SET);
-  jfclear(file);
+  if (file.fullyJournaled && file.maxPos > file.lastPersistedMaxPos) {
+    // Replay is about to grow the file, reserve the space in one go
+    file.f.preallocate(file.maxPos);
+  }
+
+  if (file.seqlock.isOpen()) {
+    // Readers in other processes wait instead of seeing a half-replayed commit
+    file.seqlock.beginCommit();
+  }
+
+  try {
+    flushJournalFile(file);
+    jfclear(file);
+  } catch (...) {
+    if (file.seqlock.isOpen()) {
+      // The journal stays ready for recovery, readers keep the previous commit meanwhile
+      file.seqlock.publish(file.seqlock.committedLength());
+    }
+
+    throw;
+  }
+
+  if (file.seqlock.isOpen()) {
+    file.seqlock.publish(file.maxPos);
+  }
 }
 
-void jfclear(JFile & file) {
+template<typename _t_backend>
+void jfclear(BasicJFile<_t_backend>& file) {
+  if (file.hasDirectWrites) {
+    // Drop everything appended past the committed end of file
+    file.f.truncate(file.lastPersistedMaxPos);
+    file.hasDirectWrites = false;
+  }
+
+  file.fullyJournaled = false;
+  file.pendingBuffer.clear();
+  file.deltaJournaled.clear();
+  file.dirtyBegin = file.dirtyEnd = 0;
+  file.copySourceBegin = file.copySourceEnd = 0;
+  file.savepoints.clear();
+  file.savepointMaxPos = 0;
   file.numCompletedBlocks = 0;
   file.journalEndPos = 0;
   file.currentBlockLength = 0;
@@ -417,16 +1640,178 @@ void jfclear(JFile & file) {
   file.maxPos = file.lastPersistedMaxPos;
 }
 
-void jfclose(JFile& file) {
-  if (file.f) {
-    fclose(file.f);
-    file.f = nullptr;
+template<typename _t_backend>
+void jfsetdelta(BasicJFile<_t_backend>& file, bool enabled) {
+  if (enabled == file.deltaMode) {
+    return;
+  }
+
+  closeBlock(file);
+
+  if (enabled && file.dirtyEnd > file.dirtyBegin) {
+    // Writes journaled so far were not tracked one by one
+    addDeltaJournaled(file, file.dirtyBegin, file.dirtyEnd);
+  }
+
+  file.deltaMode = enabled;
+}
+
+template<typename _t_backend>
+void jfsetcompression(BasicJFile<_t_backend>& file, int codec) {
+  if (codec < kCodecNone || codec >= kNumCodecs) {
+    throw runtime_error("jfsetcompression: unknown codec");
+  }
+
+  closeBlock(file);
+  file.codec = codec;
+}
+
+template<typename _t_backend>
+int jfsavepoint(BasicJFile<_t_backend>& file) {
+  closeBlock(file);
+
+  JFSavepoint savepoint;
+  savepoint.pos = file.pos;
+  savepoint.maxPos = file.maxPos;
+  savepoint.journalEndPos = file.journalEndPos;
+  savepoint.numCompletedBlocks = file.numCompletedBlocks;
+  savepoint.hasDirectWrites = file.hasDirectWrites;
+  savepoint.fullyJournaled = file.fullyJournaled;
+  savepoint.dirtyBegin = file.dirtyBegin;
+  savepoint.dirtyEnd = file.dirtyEnd;
+  savepoint.copySourceBegin = file.copySourceBegin;
+  savepoint.copySourceEnd = file.copySourceEnd;
+
+  file.savepoints.push_back(savepoint);
+  file.savepointMaxPos = max(file.savepointMaxPos, file.maxPos);
+
+  return int(file.savepoints.size());
+}
+
+template<typename _t_backend>
+void jfrollback(BasicJFile<_t_backend>& file, int savepointId) {
+  if (savepointId < 1 || savepointId > int(file.savepoints.size())) {
+    throw runtime_error("jfrollback: unknown savepoint");
   }
 
-  if (file.jf) {
-    fclose(file.jf);
-    file.jf = nullptr;
+  // Later savepoints go away, this one stays
+  file.savepoints.resize(size_t(savepointId));
+  const auto& savepoint = file.savepoints.back();
+
+  // Whatever is still in memory belongs to the discarded tail
+  file.pendingBuffer.clear();
+  file.currentBlockLength = 0;
+
+  if (file.hasDirectWrites) {
+    // Appends since the savepoint all went past its end of file
+    const auto end = max(savepoint.maxPos, file.lastPersistedMaxPos);
+    if (file.f.size() > end) {
+      file.f.truncate(end);
+    }
+  }
+
+  if (savepoint.journalEndPos != 0) {
+    // Replay stops at the block count, so the blocks past it are
+    // never read again and are overwritten by the next writes
+    unsigned char buff[8];
+    encodeI64(savepoint.numCompletedBlocks, buff);
+    file.jf.write(kFlagBytes + kVersionBytes, buff, 8);
   }
+
+  file.journalEndPos = savepoint.journalEndPos;
+  file.numCompletedBlocks = savepoint.numCompletedBlocks;
+  file.journalBlockStartPos = savepoint.journalEndPos;
+  file.hasDirectWrites = savepoint.hasDirectWrites;
+  file.fullyJournaled = savepoint.fullyJournaled;
+  file.dirtyBegin = savepoint.dirtyBegin;
+  file.dirtyEnd = savepoint.dirtyEnd;
+  file.copySourceBegin = savepoint.copySourceBegin;
+  file.copySourceEnd = savepoint.copySourceEnd;
+  file.pos = savepoint.pos;
+  file.maxPos = savepoint.maxPos;
 }
 
-}
\ No newline at end of file
+template<typename _t_backend>
+void jfrelease(BasicJFile<_t_backend>& file, int savepointId) {
+  if (savepointId < 1 || savepointId > int(file.savepoints.size())) {
+    throw runtime_error("jfrelease: unknown savepoint");
+  }
+
+  // Releasing keeps the writes, so savepointMaxPos stays as is
+  file.savepoints.resize(size_t(savepointId - 1));
+}
+
+template<typename _t_backend>
+void jfclose(BasicJFile<_t_backend>& file) {
+  if (file.jf.isOpen() && !isWriting(file)) {
+    // Nothing left to recover: leave the clean shutdown marker (see jfopen)
+    file.jf.truncate(0);
+  }
+
+  file.f.close();
+  file.jf.close();
+  file.seqlock.close();
+}
+
+template<typename _t_backend>
+uint64_t jfcommitcount(const BasicJFile<_t_backend>& file) {
+  if (file.seqlockDeferred) {
+    uint64_t sequence = 0;
+    int64_t committedLength = 0;
+    JFSeqLock::peek(seqlockPath(file.journalPath), sequence, committedLength);
+    return sequence / 2;
+  }
+
+  if (!file.seqlock.isOpen()) {
+    return 0;
+  }
+
+  return file.seqlock.commits();
+}
+
+#define JFIO_INSTANTIATE(B) \
+  template BasicJFile<B> jfopen<B>(const fs::path&, const fs::path&, const string&, const string&, int); \
+  template int64_t jfseek(BasicJFile<B>&, int64_t, int); \
+  template int64_t jftell(const BasicJFile<B>&); \
+  template void jfputc(int, BasicJFile<B>&); \
+  template void jfputs(const char*, BasicJFile<B>&); \
+  template void jfputs(const char*, uint64_t, BasicJFile<B>&); \
+  template void jfputs(const unsigned char*, uint64_t, BasicJFile<B>&); \
+  template void jfputi32(int32_t, BasicJFile<B>&); \
+  template void jfputi64(int64_t, BasicJFile<B>&); \
+  template void jfputvarint(uint64_t, BasicJFile<B>&); \
+  template void jfputsvarint(int64_t, BasicJFile<B>&); \
+  template void jfputrecord(const char*, uint64_t, BasicJFile<B>&); \
+  template void jfputrecord(const unsigned char*, uint64_t, BasicJFile<B>&); \
+  template void jfputbatch(const JFWrite*, uint64_t, BasicJFile<B>&); \
+  template void jfcopyrange(BasicJFile<B>&, int64_t, const BasicJFile<B>&, int64_t, int64_t); \
+  template void jfcopyrange(BasicJFile<B>&, int64_t, int64_t, int64_t); \
+  template void jftruncate(BasicJFile<B>&, int64_t); \
+  template int jfgetc(BasicJFile<B>&); \
+  template int64_t jfgetn(char*, uint64_t, BasicJFile<B>&); \
+  template int64_t jfgetn(unsigned char*, uint64_t, BasicJFile<B>&); \
+  template int64_t jfgetn(std::string&, uint64_t, BasicJFile<B>&); \
+  template int64_t jfgetn(std::vector<unsigned char>&, uint64_t, BasicJFile<B>&); \
+  template int32_t jfgeti32(BasicJFile<B>&); \
+  template int64_t jfgeti64(BasicJFile<B>&); \
+  template uint64_t jfgetvarint(BasicJFile<B>&); \
+  template int64_t jfgetsvarint(BasicJFile<B>&); \
+  template int64_t jfgetrecord(std::string&, BasicJFile<B>&); \
+  template int64_t jfgetrecord(std::vector<unsigned char>&, BasicJFile<B>&); \
+  template void jfflush(BasicJFile<B>&); \
+  template void jfclear(BasicJFile<B>&); \
+  template void jfsetdelta(BasicJFile<B>&, bool); \
+  template void jfsetcompression(BasicJFile<B>&, int); \
+  template int jfsavepoint(BasicJFile<B>&); \
+  template void jfrollback(BasicJFile<B>&, int); \
+  template void jfrelease(BasicJFile<B>&, int); \
+  template void jfclose(BasicJFile<B>&); \
+  template uint64_t jfcommitcount(const BasicJFile<B>&);
+
+JFIO_INSTANTIATE(StdioBackend)
+JFIO_INSTANTIATE(MemoryBackend)
+#ifndef WIN32
+JFIO_INSTANTIATE(FdBackend)
+#endif
+
+}
@@ -1,20 +1,34 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <filesystem>
 #include "jfile.h"
 #include "file2.h"
+#include "varint.h"
 
 namespace jfio {
 
 /**
  * Opens the main file and the journal file.
+ * The storage backend (see jfbackend.h) defaults to stdio,
+ * e.g. jfopen<FdBackend>(...) uses raw file descriptors instead.
  *
  * This function will also try to recover and flush any existing journal data.
  * This could happen when journalling finished previously, but failed to
  * write to the main file.
+ * jfclose empties the journal when there is nothing to recover, and opening a
+ * file with an empty journal skips recovery: the journal is then only opened
+ * once writing starts. See jfpool.h to keep many files at hand.
+ *
+ * shareMode works like _fsopen's on every platform: one writer at a time
+ * (SHARE_MODE_WRITING_SHARE_READ), with any number of SHARE_MODE_READ_ONLY
+ * readers, or a single SHARE_MODE_EXCLUSIVE open. Throws a runtime_error if
+ * another open does not allow this one. Readers only see committed data
+ * (see jfcommitcount).
  */
-JFile jfopen(
+template<typename _t_backend = StdioBackend>
+BasicJFile<_t_backend> jfopen(
   const std::filesystem::path& mainFilePath,
   const std::filesystem::path& journalFilePath,
   // Try to open the main file in this mode first.
@@ -31,105 +45,295 @@ JFile jfopen(
  * Note: This function does not actually perform an fseek on the main file,
  * since the main file content might not exist before the journal got flushed.
  */
-int64_t jfseek(JFile& file, int64_t offset, int origin);
+template<typename _t_backend>
+int64_t jfseek(BasicJFile<_t_backend>& file, int64_t offset, int origin);
 
 /**
  * Returns the current position.
  */
-int64_t jftell(const JFile& file);
+template<typename _t_backend>
+int64_t jftell(const BasicJFile<_t_backend>& file);
 
 /**
  * Writes one character to the journal at the jftell() position.
  */
-void jfputc(int ch, JFile& file);
+template<typename _t_backend>
+void jfputc(int ch, BasicJFile<_t_backend>& file);
 
 /**
  * Writes one the null-terminated string to the journal at the jftell() position.
  */
-void jfputs(const char* str, JFile& file);
+template<typename _t_backend>
+void jfputs(const char* str, BasicJFile<_t_backend>& file);
 
 /**
  * Writes n characters to the journal at the jftell() position.
  */
-void jfputs(const char* str, uint64_t n, JFile& file);
+template<typename _t_backend>
+void jfputs(const char* str, uint64_t n, BasicJFile<_t_backend>& file);
 
 /**
  * Writes n bytes to the journal at the jftell() position.
  */
-void jfputs(const unsigned char* str, uint64_t n, JFile& file);
+template<typename _t_backend>
+void jfputs(const unsigned char* str, uint64_t n, BasicJFile<_t_backend>& file);
 
 /**
  * Writes a 32 bit integer to the file as 4 bytes.
  */
-void jfputi32(int32_t i, JFile& file);
+template<typename _t_backend>
+void jfputi32(int32_t i, BasicJFile<_t_backend>& file);
 
 /**
  * Writes as 64 bit integer to the file as 8 bytes.
  */
-void jfputi64(int64_t i, JFile& file);
+template<typename _t_backend>
+void jfputi64(int64_t i, BasicJFile<_t_backend>& file);
+
+/**
+ * Writes an unsigned integer as a varint (LEB128), 1 to 10 bytes.
+ */
+template<typename _t_backend>
+void jfputvarint(uint64_t i, BasicJFile<_t_backend>& file);
+
+/**
+ * Writes a signed integer as a zigzag encoded varint,
+ * so small negative numbers are short as well.
+ */
+template<typename _t_backend>
+void jfputsvarint(int64_t i, BasicJFile<_t_backend>& file);
+
+/**
+ * Writes a record: its length as a varint, followed by n bytes.
+ */
+template<typename _t_backend>
+void jfputrecord(const char* str, uint64_t n, BasicJFile<_t_backend>& file);
+
+/**
+ * Writes a record: its length as a varint, followed by n bytes.
+ */
+template<typename _t_backend>
+void jfputrecord(const unsigned char* str, uint64_t n, BasicJFile<_t_backend>& file);
+
+/**
+ * One write of a jfputbatch call: length bytes of data at pos.
+ */
+struct JFWrite {
+  int64_t pos = 0;
+  const unsigned char* data = nullptr;
+  uint64_t length = 0;
+};
+
+/**
+ * Writes n scattered writes in one go, without moving jftell().
+ * The writes are sorted and merged (later writes in the list win where
+ * they overlap), then journaled as a single block: a compact table of
+ * positions and lengths followed by all the bytes back to back.
+ * Writes may extend the file, but not leave a hole past its end,
+ * otherwise a runtime_error is thrown and nothing is written.
+ */
+template<typename _t_backend>
+void jfputbatch(const JFWrite* writes, uint64_t n, BasicJFile<_t_backend>& file);
+
+/**
+ * Copies count bytes of committed content from src (starting at srcPos)
+ * to dstPos in the file, without moving jftell().
+ * Only a small descriptor is journaled. The bytes are copied in the kernel
+ * when the journal is flushed, so they never pass through user space.
+ * dstPos may not be past the end of the file.
+ * The source file must not commit changes to the copied range
+ * until this file is flushed.
+ * Replay (and recovery) opens the source read-only, so it must not be held
+ * exclusively until then. A source opened with SHARE_MODE_EXCLUSIVE is refused
+ * with a runtime_error.
+ */
+template<typename _t_backend>
+void jfcopyrange(
+  BasicJFile<_t_backend>& file,
+  int64_t dstPos,
+  const BasicJFile<_t_backend>& src,
+  int64_t srcPos,
+  int64_t count
+);
+
+/**
+ * Copies count bytes of committed content within the file.
+ * The source range must not overlap the destination, and must not be
+ * written in the current session (before or after this call),
+ * otherwise a runtime_error is thrown.
+ */
+template<typename _t_backend>
+void jfcopyrange(BasicJFile<_t_backend>& file, int64_t dstPos, int64_t srcPos, int64_t count);
+
+/**
+ * Shrinks the file to length bytes when the journal is flushed.
+ * jftell() is moved back to length if it was past it.
+ */
+template<typename _t_backend>
+void jftruncate(BasicJFile<_t_backend>& file, int64_t length);
 
 /**
  * Reads a charater from the main file at jftell() position.
  * Before the journal is flushed, this function will return EOF.
  */
-int jfgetc(JFile& file);
+template<typename _t_backend>
+int jfgetc(BasicJFile<_t_backend>& file);
 
 /**
  * Reads at most n characters from the main file at jftell() position.
  * Returns the number of characters read.
  * Before the journal is flushed, this function will return EOF.
  */
-int64_t jfgetn(char* s, uint64_t count, JFile& file);
+template<typename _t_backend>
+int64_t jfgetn(char* s, uint64_t count, BasicJFile<_t_backend>& file);
 
 /**
  * Reads at most n bytes from the main file at jftell() position.
  * Returns the number of bytes read.
  * Before the journal is flushed, this function will return EOF.
  */
-int64_t jfgetn(unsigned char* s, uint64_t count, JFile& file);
+template<typename _t_backend>
+int64_t jfgetn(unsigned char* s, uint64_t count, BasicJFile<_t_backend>& file);
 
 /**
  * Reads at most n characters from the main file at jftell() position.
  * Returns the number of characters read.
  * Before the journal is flushed, this function will return EOF.
  */
-int64_t jfgetn(std::string& s, uint64_t count, JFile& file);
+template<typename _t_backend>
+int64_t jfgetn(std::string& s, uint64_t count, BasicJFile<_t_backend>& file);
 
 /**
  * Reads at most n bytes from the main file at jftell() position.
  * Returns the number of bytes read.
  * Before the journal is flushed, this function will return EOF.
  */
-int64_t jfgetn(std::vector<unsigned char>& buff, uint64_t count, JFile& file);
+template<typename _t_backend>
+int64_t jfgetn(std::vector<unsigned char>& buff, uint64_t count, BasicJFile<_t_backend>& file);
 
 /**
  * Reads a 32 bit number (4 bytes) from the main file at jftell() position.
  * Before the journal is flushed, of the main file does not have at least 4 bytes,
  * a runtime_error will be thrown.
  */
-int32_t jfgeti32(JFile& file);
+template<typename _t_backend>
+int32_t jfgeti32(BasicJFile<_t_backend>& file);
 
 /**
  * Reads a 64 bit number (8 bytes) from the main file at jftell() position.
  * Before the journal is flushed, of the main file does not have at least 4 bytes,
  * a runtime_error will be thrown.
  */
-int64_t jfgeti64(JFile& file);
+template<typename _t_backend>
+int64_t jfgeti64(BasicJFile<_t_backend>& file);
+
+/**
+ * Reads a varint from the main file at jftell() position.
+ * Before the journal is flushed, or if the varint is incomplete,
+ * a runtime_error will be thrown.
+ */
+template<typename _t_backend>
+uint64_t jfgetvarint(BasicJFile<_t_backend>& file);
+
+/**
+ * Reads a zigzag encoded varint from the main file at jftell() position.
+ * Before the journal is flushed, or if the varint is incomplete,
+ * a runtime_error will be thrown.
+ */
+template<typename _t_backend>
+int64_t jfgetsvarint(BasicJFile<_t_backend>& file);
+
+/**
+ * Reads a record written by jfputrecord and appends its content to s.
+ * Returns the record length, or EOF at the end of the file.
+ * Before the journal is flushed, or if the record is incomplete,
+ * a runtime_error will be thrown.
+ */
+template<typename _t_backend>
+int64_t jfgetrecord(std::string& s, BasicJFile<_t_backend>& file);
+
+/**
+ * Reads a record written by jfputrecord and appends its content to buff.
+ * Returns the record length, or EOF at the end of the file.
+ * Before the journal is flushed, or if the record is incomplete,
+ * a runtime_error will be thrown.
+ */
+template<typename _t_backend>
+int64_t jfgetrecord(std::vector<unsigned char>& buff, BasicJFile<_t_backend>& file);
 
 /**
  * Commits the writes in the journal to the main file.
  */
-void jfflush(JFile& file);
+template<typename _t_backend>
+void jfflush(BasicJFile<_t_backend>& file);
 
 /**
  * Clear all the (unflushed) journal progress,
  * and restores the file position to before the
  * current journaling session starts.
  */
-void jfclear(JFile& file);
+template<typename _t_backend>
+void jfclear(BasicJFile<_t_backend>& file);
+
+/**
+ * Turns delta journaling on or off (off by default).
+ * In delta mode, journaled writes are compared against the main file
+ * when their block closes, and runs that would not change anything are
+ * dropped from the journal. Rewriting records that barely changed then
+ * costs neither journal space nor replay I/O, at the price of reading
+ * the main file (see JFStats for the compare cost).
+ * Delta mode pauses for the rest of a session once it journals a
+ * jfcopyrange or jftruncate.
+ */
+template<typename _t_backend>
+void jfsetdelta(BasicJFile<_t_backend>& file, bool enabled);
+
+/**
+ * Sets the codec for journal blocks (kCodecNone by default, see jfcompress.h):
+ * kCodecZeroRuns elides runs of zero bytes, kCodecLZ also finds repeats.
+ * Journaled writes are then held back until their block closes and the
+ * block is compressed as a whole, or kept raw if that is not smaller.
+ * Journal files stay readable whatever the codec, since each block records its own.
+ */
+template<typename _t_backend>
+void jfsetcompression(BasicJFile<_t_backend>& file, int codec);
+
+/**
+ * Marks the current state of the journaling session and returns its id.
+ * Savepoints nest: ids count up from 1 within a session, and jfflush
+ * or jfclear drop them all.
+ */
+template<typename _t_backend>
+int jfsavepoint(BasicJFile<_t_backend>& file);
+
+/**
+ * Undoes every write since the savepoint, including the position and
+ * the end of file, and drops the savepoints taken after it.
+ * The savepoint itself stays, so it can be rolled back to again.
+ * The journal tail is dropped by rewriting its block count,
+ * whatever the amount of work undone.
+ */
+template<typename _t_backend>
+void jfrollback(BasicJFile<_t_backend>& file, int savepoint);
+
+/**
+ * Drops the savepoint and the ones taken after it, keeping their writes.
+ */
+template<typename _t_backend>
+void jfrelease(BasicJFile<_t_backend>& file, int savepoint);
 
 /**
  * Closes all the file handles of the file.
  */
-void jfclose(JFile& file);
+template<typename _t_backend>
+void jfclose(BasicJFile<_t_backend>& file);
+
+/**
+ * Returns the number of commits made to the file by any process, as seen
+ * through the commit counter shared with the writer (0 if there is none, e.g.
+ * exclusive opens or the memory backend). A reader caching file content
+ * can compare it with the count it cached at to find out the cache is stale.
+ */
+template<typename _t_backend>
+uint64_t jfcommitcount(const BasicJFile<_t_backend>& file);
 }
\ No newline at end of file
@@ -0,0 +1,696 @@
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef WIN32
+#include <sys/wait.h>
+#endif
+
+#include "jfio/jfio.h"
+#include "jfio/jfscan.h"
+#include "jfio/jfpool.h"
+#include "jfio/jfkv.h"
+#include "jfio/varint.h"
+
+namespace fs = std::filesystem;
+
+using namespace std;
+using namespace jfio;
+
+// Micro benchmarks. Run all sections, or name the ones to run:
+//   jfio_bench varint scan batch delta compression open kv
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* name, double seconds, uint64_t items, uint64_t bytes) {
+  printf(
+    "  %-32s %8.3f ms  %10.1f M items/s  %9.1f MB/s\n",
+    name,
+    seconds * 1e3,
+    items / seconds / 1e6,
+    bytes / seconds / 1e6
+  );
+}
+
+// Keeps the optimizer from dropping benchmark loops
+static volatile uint64_t sink = 0;
+
+/**
+ * A mix of fields typical for our log records:
+ * id deltas, millisecond timestamp deltas, signed balance changes and payload lengths.
+ */
+static void benchVarint() {
+  constexpr uint64_t kNumRecords = 2'000'000;
+  constexpr uint64_t kFieldsPerRecord = 4;
+
+  mt19937_64 rng(42);
+  vector<uint64_t> values;
+  values.reserve(kNumRecords * kFieldsPerRecord);
+
+  for (uint64_t i = 0; i < kNumRecords; i++) {
+    values.push_back(1 + rng() % 10);
+    values.push_back(rng() % 60'000);
+    values.push_back(zigzagEncode(int64_t(rng() % 2001) - 1000));
+    values.push_back(rng() % 200);
+  }
+
+  const uint64_t fixedBytes = kNumRecords * (8 + 8 + 8 + 4);
+  vector<unsigned char> encoded(values.size() * kMaxVarintBytes);
+
+  auto start = chrono::steady_clock::now();
+  uint64_t n = 0;
+  for (const auto v : values) {
+    n += encodeVarint(v, encoded.data() + n);
+  }
+  const auto encodeSeconds = secondsSince(start);
+  encoded.resize(n);
+
+  printf("varint: %llu records, %llu fields\n",
+    (unsigned long long)kNumRecords, (unsigned long long)values.size());
+  printf("  fixed width: %llu bytes, varint: %llu bytes (%.1f%% smaller)\n",
+    (unsigned long long)fixedBytes,
+    (unsigned long long)n,
+    100.0 * (1.0 - double(n) / fixedBytes));
+
+  report("encode", encodeSeconds, values.size(), n);
+
+  vector<uint64_t> decoded(values.size());
+
+  start = chrono::steady_clock::now();
+  uint64_t pos = 0;
+  for (uint64_t i = 0; i < values.size(); i++) {
+    pos += decodeVarint(encoded.data() + pos, n - pos, decoded[i]);
+  }
+  report("decode (one at a time)", secondsSince(start), values.size(), n);
+  sink += decoded.back();
+
+  start = chrono::steady_clock::now();
+  uint64_t consumed = 0;
+  const auto count = decodeVarints(encoded.data(), n, decoded.data(), decoded.size(), consumed);
+  report("decode (bulk)", secondsSince(start), count, consumed);
+
+  if (count != values.size() || decoded != values) {
+    printf("  bulk decode mismatch!\n");
+  }
+
+  // Through jfio: the same records with jfputi64/jfputi32 vs varints
+  const fs::path fixedPath = "bench-varint-fixed";
+  const fs::path varintPath = "bench-varint";
+  const fs::path journalPath = "bench-varint-journal";
+
+  auto fixedFile = jfopen<MemoryBackend>(fixedPath, journalPath, "wb+", "");
+  start = chrono::steady_clock::now();
+  for (uint64_t i = 0; i < values.size(); i += kFieldsPerRecord) {
+    jfputi64(values[i], fixedFile);
+    jfputi64(values[i + 1], fixedFile);
+    jfputi64(values[i + 2], fixedFile);
+    jfputi32(int32_t(values[i + 3]), fixedFile);
+  }
+  jfflush(fixedFile);
+  report("jfputi64/jfputi32 + jfflush", secondsSince(start), values.size(), fixedBytes);
+  jfclose(fixedFile);
+
+  auto varintFile = jfopen<MemoryBackend>(varintPath, journalPath, "wb+", "");
+  start = chrono::steady_clock::now();
+  for (const auto v : values) {
+    jfputvarint(v, varintFile);
+  }
+  jfflush(varintFile);
+  report("jfputvarint + jfflush", secondsSince(start), values.size(), n);
+  jfclose(varintFile);
+
+  MemoryBackend::remove(fixedPath);
+  MemoryBackend::remove(varintPath);
+  MemoryBackend::remove(journalPath);
+}
+
+static void reportBytes(const char* name, double seconds, uint64_t bytes) {
+  printf("  %-32s %8.3f ms  %9.1f MB/s\n", name, seconds * 1e3, bytes / seconds / 1e6);
+}
+
+static uint64_t checksum(const unsigned char* data, uint64_t length) {
+  uint64_t sum = 0;
+  for (uint64_t i = 0; i + 8 <= length; i += 8) {
+    uint64_t word = 0;
+    memcpy(&word, data + i, 8);
+    sum += word;
+  }
+
+  return sum;
+}
+
+/**
+ * Evicts the (clean) pages of the file from the page cache,
+ * so the next read has to go to the device.
+ */
+static void dropFromPageCache(const fs::path& path) {
+  #ifndef WIN32
+  const int fd = open(path.string().c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+  #endif
+}
+
+/**
+ * Full file scan with a checksum as the consumer's work.
+ * Every run starts with the file evicted from the page cache.
+ */
+static void benchScan() {
+  constexpr uint64_t kFileBytes = 256 * 1024 * 1024;
+  const fs::path path = "bench-scan.dat";
+  const fs::path journalPath = "bench-scan.journal";
+
+  {
+    vector<unsigned char> block(1024 * 1024);
+    mt19937_64 rng(42);
+    for (auto& b : block) {
+      b = static_cast<unsigned char>(rng());
+    }
+
+    auto file = jfopen(path, journalPath, "wb+", "");
+    for (uint64_t n = 0; n < kFileBytes; n += block.size()) {
+      jfputs(block.data(), block.size(), file);
+    }
+    jfflush(file);
+    jfclose(file);
+  }
+
+  printf("scan: %llu MB file, cold page cache\n", (unsigned long long)(kFileBytes >> 20));
+
+  {
+    dropFromPageCache(path);
+    auto file = jfopen<FdBackend>(path, journalPath, "rb", "", SHARE_MODE_READ_ONLY);
+    vector<unsigned char> buff(kDefaultScanChunkBytes);
+    const auto start = chrono::steady_clock::now();
+    while (jfgetn(buff.data(), buff.size(), file) > 0) {
+    }
+    reportBytes("raw read, no work", secondsSince(start), kFileBytes);
+    jfclose(file);
+  }
+
+  {
+    dropFromPageCache(path);
+    auto file = jfopen(path, journalPath, "rb", "", SHARE_MODE_READ_ONLY);
+    unsigned char buff[4096];
+    const auto start = chrono::steady_clock::now();
+    int64_t n = 0;
+    while ((n = jfgetn(buff, sizeof(buff), file)) > 0) {
+      sink += checksum(buff, n);
+    }
+    reportBytes("jfgetn 4KB + checksum", secondsSince(start), kFileBytes);
+    jfclose(file);
+  }
+
+  {
+    dropFromPageCache(path);
+    auto file = jfopen<FdBackend>(path, journalPath, "rb", "", SHARE_MODE_READ_ONLY);
+    vector<unsigned char> buff(kDefaultScanChunkBytes);
+    const auto start = chrono::steady_clock::now();
+    int64_t n = 0;
+    while ((n = jfgetn(buff.data(), buff.size(), file)) > 0) {
+      sink += checksum(buff.data(), n);
+    }
+    reportBytes("jfgetn 1MB + checksum", secondsSince(start), kFileBytes);
+    jfclose(file);
+  }
+
+  {
+    dropFromPageCache(path);
+    auto file = jfopen<FdBackend>(path, journalPath, "rb", "", SHARE_MODE_READ_ONLY);
+    const auto start = chrono::steady_clock::now();
+    auto scan = jfscanopen(file);
+    const unsigned char* data = nullptr;
+    uint64_t length = 0;
+    while (jfscannext(scan, data, length)) {
+      sink += checksum(data, length);
+    }
+    jfscanclose(scan);
+    reportBytes("jfscan 3x1MB + checksum", secondsSince(start), kFileBytes);
+    jfclose(file);
+  }
+
+  fs::remove(path);
+  fs::remove(journalPath);
+}
+
+/**
+ * 100k random 8 byte updates to a 64MB file in one commit:
+ * jfseek + jfputi64 per update vs a single jfputbatch.
+ */
+static void benchBatch() {
+  constexpr uint64_t kFileBytes = 64 * 1024 * 1024;
+  constexpr uint64_t kUpdates = 100'000;
+  const fs::path path = "bench-batch.dat";
+  const fs::path journalPath = "bench-batch.journal";
+
+  {
+    vector<unsigned char> block(1024 * 1024);
+    auto file = jfopen(path, journalPath, "wb+", "");
+    for (uint64_t n = 0; n < kFileBytes; n += block.size()) {
+      jfputs(block.data(), block.size(), file);
+    }
+    jfflush(file);
+    jfclose(file);
+  }
+
+  mt19937_64 rng(42);
+  vector<int64_t> positions(kUpdates);
+  vector<int64_t> values(kUpdates);
+  for (uint64_t i = 0; i < kUpdates; i++) {
+    positions[i] = int64_t(rng() % (kFileBytes / 8)) * 8;
+    values[i] = int64_t(rng());
+  }
+
+  printf("batch: %llu random 8 byte updates per commit, %llu MB file\n",
+    (unsigned long long)kUpdates, (unsigned long long)(kFileBytes >> 20));
+
+  auto file = jfopen(path, journalPath, "rb+", "");
+
+  auto start = chrono::steady_clock::now();
+  for (uint64_t i = 0; i < kUpdates; i++) {
+    jfseek(file, positions[i], SEEK_SET);
+    jfputi64(values[i], file);
+  }
+  const auto seekJournalBytes = file.journalEndPos;
+  report("jfseek + jfputi64", secondsSince(start), kUpdates, kUpdates * 8);
+
+  start = chrono::steady_clock::now();
+  jfflush(file);
+  report("  jfflush", secondsSince(start), kUpdates, kUpdates * 8);
+
+  start = chrono::steady_clock::now();
+  vector<unsigned char> encoded(kUpdates * 8);
+  vector<JFWrite> writes(kUpdates);
+  for (uint64_t i = 0; i < kUpdates; i++) {
+    for (int k = 0; k < 8; k++) {
+      encoded[i * 8 + k] = static_cast<unsigned char>(values[i] >> (56 - k * 8));
+    }
+
+    writes[i] = { positions[i], encoded.data() + i * 8, 8 };
+  }
+  jfputbatch(writes.data(), writes.size(), file);
+  const auto batchJournalBytes = file.journalEndPos;
+  report("jfputbatch", secondsSince(start), kUpdates, kUpdates * 8);
+
+  start = chrono::steady_clock::now();
+  jfflush(file);
+  report("  jfflush", secondsSince(start), kUpdates, kUpdates * 8);
+
+  printf("  journal bytes: %lld per-write blocks, %lld batch\n",
+    (long long)seekJournalBytes, (long long)batchJournalBytes);
+
+  jfclose(file);
+  fs::remove(path);
+  fs::remove(journalPath);
+}
+
+/**
+ * Rewrites a 32MB table of 64 byte records in one commit, with a share of the
+ * records changed, with and without delta journaling.
+ */
+static void benchDelta() {
+  constexpr uint64_t kFileBytes = 32 * 1024 * 1024;
+  constexpr uint64_t kRecordBytes = 64;
+  const fs::path path = "bench-delta.dat";
+  const fs::path journalPath = "bench-delta.journal";
+
+  vector<unsigned char> table(kFileBytes);
+  mt19937_64 rng(42);
+  for (auto& b : table) {
+    b = static_cast<unsigned char>(rng());
+  }
+
+  printf("delta: rewrite a %llu MB table of %llu byte records in one commit\n",
+    (unsigned long long)(kFileBytes >> 20), (unsigned long long)kRecordBytes);
+
+  for (const double changedShare : { 0.0, 0.01, 0.1, 1.0 }) {
+    for (const bool delta : { false, true }) {
+      {
+        auto file = jfopen(path, journalPath, "wb+", "");
+        jfputs(table.data(), table.size(), file);
+        jfflush(file);
+        jfclose(file);
+      }
+
+      auto updated = table;
+      for (uint64_t pos = 0; pos < kFileBytes; pos += kRecordBytes) {
+        if (double(rng() % 10000) < changedShare * 10000) {
+          updated[pos + rng() % kRecordBytes] ^= 0xFF;
+        }
+      }
+
+      auto file = jfopen(path, journalPath, "rb+", "");
+      jfsetdelta(file, delta);
+
+      const auto start = chrono::steady_clock::now();
+      for (uint64_t pos = 0; pos < kFileBytes; pos += kRecordBytes) {
+        jfputs(updated.data() + pos, kRecordBytes, file);
+      }
+      const auto journalBytes = file.journalEndPos;
+      jfflush(file);
+      const auto seconds = secondsSince(start);
+
+      char name[64];
+      snprintf(name, sizeof(name), "%5.1f%% changed, delta %s", changedShare * 100, delta ? "on" : "off");
+      reportBytes(name, seconds, kFileBytes);
+      printf("    journal %6.2f MB", journalBytes / 1e6);
+      if (delta) {
+        printf(", compare %.2f ms (%.1f GB/s), %.1f%% dropped",
+          file.stats.deltaCompareNanos / 1e6,
+          double(file.stats.deltaComparedBytes) / file.stats.deltaCompareNanos,
+          100.0 * file.stats.deltaDroppedBytes / file.stats.deltaComparedBytes);
+      }
+      printf("\n");
+
+      jfclose(file);
+    }
+  }
+
+  fs::remove(path);
+  fs::remove(journalPath);
+}
+
+/**
+ * Rewrites 16MB in one commit with each codec, for text-like records,
+ * a sparse table (mostly zeros) and random bytes.
+ */
+static void benchCompression() {
+  constexpr uint64_t kFileBytes = 16 * 1024 * 1024;
+  const fs::path path = "bench-compression.dat";
+  const fs::path journalPath = "bench-compression.journal";
+
+  mt19937_64 rng(42);
+
+  vector<unsigned char> text;
+  text.reserve(kFileBytes + 128);
+  while (text.size() < kFileBytes) {
+    char record[128];
+    const auto length = snprintf(record, sizeof(record),
+      "{\"id\":%llu,\"name\":\"user%llu\",\"balance\":%llu,\"active\":%s}\n",
+      (unsigned long long)(text.size() / 64), (unsigned long long)(rng() % 100000),
+      (unsigned long long)(rng() % 1000000), rng() % 2 ? "true" : "false");
+    text.insert(text.end(), record, record + length);
+  }
+  text.resize(kFileBytes);
+
+  vector<unsigned char> sparse(kFileBytes, 0);
+  for (uint64_t pos = 0; pos < kFileBytes; pos += 256) {
+    for (uint64_t k = 0; k < 16; k++) {
+      sparse[pos + k] = static_cast<unsigned char>(rng());
+    }
+  }
+
+  vector<unsigned char> random(kFileBytes);
+  for (auto& b : random) {
+    b = static_cast<unsigned char>(rng());
+  }
+
+  const pair<const char*, const vector<unsigned char>*> payloads[] = {
+    { "text", &text },
+    { "sparse", &sparse },
+    { "random", &random },
+  };
+  const char* codecNames[] = { "none", "zero runs", "lz" };
+
+  printf("compression: rewrite %llu MB in one commit\n", (unsigned long long)(kFileBytes >> 20));
+
+  for (const auto& payload : payloads) {
+    for (int codec = kCodecNone; codec < kNumCodecs; codec++) {
+      {
+        auto file = jfopen(path, journalPath, "wb+", "");
+        jfputs(string(kFileBytes, '.').c_str(), file);
+        jfflush(file);
+        jfclose(file);
+      }
+
+      // The last blocks are only written when the commit closes them, so measure the journal file
+      fs::remove(journalPath);
+      auto file = jfopen(path, journalPath, "rb+", "");
+      jfsetcompression(file, codec);
+
+      const auto& data = *payload.second;
+      const auto start = chrono::steady_clock::now();
+      for (uint64_t pos = 0; pos < kFileBytes; pos += 4096) {
+        jfputs(data.data() + pos, 4096, file);
+      }
+      jfflush(file);
+      const auto seconds = secondsSince(start);
+      const auto journalBytes = int64_t(fs::file_size(journalPath));
+
+      char name[64];
+      snprintf(name, sizeof(name), "%s, %s", payload.first, codecNames[codec]);
+      reportBytes(name, seconds, kFileBytes);
+      printf("    journal %6.2f MB (%.1f%% of the data)", journalBytes / 1e6, 100.0 * journalBytes / kFileBytes);
+      if (codec != kCodecNone) {
+        printf(", %.2f MB saved, compress %.2f ms, decompress %.2f ms",
+          (double(file.stats.compressInputBytes) - file.stats.compressOutputBytes) / 1e6,
+          file.stats.compressNanos / 1e6, file.stats.decompressNanos / 1e6);
+      }
+      printf("\n");
+
+      jfclose(file);
+    }
+  }
+
+  fs::remove(path);
+  fs::remove(journalPath);
+}
+
+/**
+ * Opens and closes 1000 small files, with a journal left by a clean close
+ * (fast open) or a stale one that has to be inspected, then reads them
+ * in random order through pools of different sizes.
+ */
+static void benchOpen() {
+  constexpr int kFiles = 1000;
+  constexpr int kRounds = 5;
+  const fs::path dir = "bench-open";
+
+  fs::create_directories(dir);
+  vector<fs::path> paths;
+  for (int i = 0; i < kFiles; i++) {
+    paths.push_back(dir / (to_string(i) + ".dat"));
+    auto file = jfopen(paths.back(), fs::path(paths.back()) += ".journal", "wb+", "");
+    jfputs(string(4096, 'x').c_str(), file);
+    jfflush(file);
+    jfclose(file);
+  }
+
+  printf("open: %d files of 4KB\n", kFiles);
+
+  for (const bool stale : { true, false }) {
+    for (const int shareMode : { SHARE_MODE_WRITING_SHARE_READ, SHARE_MODE_EXCLUSIVE }) {
+      if (stale) {
+        // What every close used to leave behind: a cleared journal with its old content
+        for (const auto& path : paths) {
+          auto journal = fopen2(fs::path(path) += ".journal", "wb", "");
+          fputs("C0000000000000000000", journal);
+          fclose(journal);
+        }
+      }
+
+      const auto start = chrono::steady_clock::now();
+      for (int round = 0; round < kRounds; round++) {
+        for (const auto& path : paths) {
+          auto file = jfopen(path, fs::path(path) += ".journal", "rb+", "", shareMode);
+          sink += uint64_t(jfseek(file, 0, SEEK_END));
+          jfclose(file);
+        }
+      }
+
+      char name[64];
+      snprintf(name, sizeof(name), "jfopen, %s journal, %s",
+        stale ? "stale" : "clean", shareMode == SHARE_MODE_EXCLUSIVE ? "exclusive" : "share read");
+      const auto seconds = secondsSince(start);
+      printf("  %-40s %8.3f ms  %9.0f opens/s\n", name, seconds * 1e3, kFiles * kRounds / seconds);
+    }
+  }
+
+  for (const size_t maxOpen : { size_t(kFiles / 10), size_t(kFiles) }) {
+    auto pool = jfpoolopen(maxOpen);
+    mt19937 rng(42);
+
+    const auto start = chrono::steady_clock::now();
+    for (int i = 0; i < kFiles * kRounds * 10; i++) {
+      const auto& path = paths[rng() % kFiles];
+      auto& file = jfpoolget(pool, path, fs::path(path) += ".journal", "rb+", "");
+      sink += uint64_t(jfgetc(file));
+      jfseek(file, 0, SEEK_SET);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "jfpoolget, %zu open", maxOpen);
+    const auto seconds = secondsSince(start);
+    printf("  %-40s %8.3f ms  %9.0f gets/s, %llu opens\n",
+      name, seconds * 1e3, kFiles * kRounds * 10 / seconds, (unsigned long long)pool.opens);
+
+    jfpoolclose(pool);
+  }
+
+  fs::remove_all(dir);
+}
+
+/**
+ * Loads 200k keys into a key-value store, then measures point lookups
+ * (with a large and a tiny index cache), updates per commit for
+ * different commit sizes, and recovery of an interrupted commit.
+ */
+static void benchKV() {
+  constexpr int kKeys = 200000;
+  constexpr int kLookups = 200000;
+  const fs::path path = "bench-kv.dat";
+  const fs::path journalPath = "bench-kv.journal";
+
+  fs::remove(path);
+  fs::remove(journalPath);
+
+  auto keyOf = [](uint64_t i) {
+    char key[32];
+    snprintf(key, sizeof(key), "user:%010llu", (unsigned long long)i);
+    return string(key);
+  };
+
+  mt19937_64 rng(42);
+  auto valueOf = [&](uint64_t i) {
+    return string(100, char('a' + (i + rng()) % 26));
+  };
+
+  printf("kv: %d keys, 16 byte keys, 100 byte values\n", kKeys);
+
+  {
+    auto kv = jfkvopen(path, journalPath);
+    const auto start = chrono::steady_clock::now();
+    for (int i = 0; i < kKeys; i++) {
+      jfkvput(kv, keyOf(i), valueOf(i));
+      if (i % 10000 == 9999) {
+        jfkvcommit(kv);
+      }
+    }
+    jfkvcommit(kv);
+    report("load, 10k keys per commit", secondsSince(start), kKeys, 0);
+    jfkvclose(kv);
+  }
+
+  for (const uint64_t cachePages : { uint64_t(kDefaultKVCachePages), uint64_t(4) }) {
+    auto kv = jfkvopen(path, journalPath, cachePages);
+
+    string value;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < kLookups; i++) {
+      sink += jfkvget(kv, keyOf(rng() % kKeys), value) ? value.size() : 0;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "get, %llu cached pages", (unsigned long long)cachePages);
+    report(name, secondsSince(start), kLookups, 0);
+    printf("    index cache hit rate %.1f%%\n",
+      100.0 * kv.stats.cacheHits / (kv.stats.cacheHits + kv.stats.cacheMisses));
+
+    vector<JFKVItem> items(1000);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < kLookups; i += int(items.size())) {
+      for (auto& item : items) {
+        item.key = keyOf(rng() % kKeys);
+      }
+
+      jfkvgetbatch(kv, items.data(), items.size());
+      sink += items[0].value.size();
+    }
+
+    snprintf(name, sizeof(name), "getbatch 1000, %llu cached pages", (unsigned long long)cachePages);
+    report(name, secondsSince(start), kLookups, 0);
+
+    jfkvclose(kv);
+  }
+
+  {
+    auto kv = jfkvopen(path, journalPath);
+    for (const int perCommit : { 1, 10, 100, 1000, 10000 }) {
+      const int updates = max(perCommit * 10, 1000);
+      const auto start = chrono::steady_clock::now();
+      for (int i = 0; i < updates; i++) {
+        jfkvput(kv, keyOf(rng() % kKeys), valueOf(i));
+        if (i % perCommit == perCommit - 1) {
+          jfkvcommit(kv);
+        }
+      }
+
+      const auto seconds = secondsSince(start);
+      char name[64];
+      snprintf(name, sizeof(name), "put, %d per commit", perCommit);
+      report(name, seconds, updates, 0);
+      printf("    %.0f commits/s\n", updates / perCommit / seconds);
+    }
+
+    jfkvclose(kv);
+  }
+
+  #ifndef WIN32
+  for (const int perCommit : { 1000, 10000, 100000 }) {
+    // Commit in a child that exits right away, leaving the replayed journal behind,
+    // then mark it ready again as if the child had died before replaying it
+    const auto child = fork();
+    if (child == 0) {
+      auto kv = jfkvopen(path, journalPath);
+      for (int i = 0; i < perCommit; i++) {
+        jfkvput(kv, keyOf(rng() % kKeys), valueOf(i));
+      }
+      jfkvcommit(kv);
+      _exit(0);
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+
+    auto journal = fopen2(journalPath, "rb+", "");
+    fputc('R', journal);
+    fclose(journal);
+
+    const auto journalBytes = fs::file_size(journalPath);
+    const auto start = chrono::steady_clock::now();
+    auto kv = jfkvopen(path, journalPath);
+    const auto seconds = secondsSince(start);
+
+    char name[64];
+    snprintf(name, sizeof(name), "recovery, %d puts", perCommit);
+    report(name, seconds, perCommit, journalBytes);
+    jfkvclose(kv);
+  }
+  #endif
+
+  fs::remove(path);
+  fs::remove(journalPath);
+}
+
+int main(int argc, char** argv) {
+  const vector<pair<string, function<void()>>> sections = {
+    { "varint", benchVarint },
+    { "scan", benchScan },
+    { "batch", benchBatch },
+    { "delta", benchDelta },
+    { "compression", benchCompression },
+    { "open", benchOpen },
+    { "kv", benchKV },
+  };
+
+  for (const auto& section : sections) {
+    bool selected = argc < 2;
+    for (int i = 1; i < argc; i++) {
+      selected = selected || section.first == argv[i];
+    }
+
+    if (selected) {
+      section.second();
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,270 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "jfio/jfcompress.h"
+#include "jfio/jfinspect.h"
+#include "jfio/jfjournal.h"
+
+namespace fs = std::filesystem;
+
+using namespace std;
+using namespace jfio;
+
+// Offline journal analysis:
+//   jfio_inspect [--json] [--dry-run MAIN COPY] JOURNAL
+//
+// Decodes and validates the journal, lists its blocks, and reports redundant
+// writes, write amplification and the cost of replaying it.
+// --dry-run replays the journal against a copy of the main file, written to COPY,
+// which must not exist yet. The main file and the journal are never changed.
+// Exits with 1 if the journal is invalid, 2 on usage or IO errors.
+
+static const char* flagName(int flag) {
+  switch (flag) {
+  case kJournaling:
+    return "journaling";
+  case kJournalReady:
+    return "ready";
+  case kJournalCleared:
+    return "cleared";
+  case 0:
+    return "empty";
+  default:
+    return "unknown";
+  }
+}
+
+static const char* codecName(int codec) {
+  switch (codec) {
+  case kCodecNone:
+    return "none";
+  case kCodecZeroRuns:
+    return "zeroruns";
+  case kCodecLZ:
+    return "lz";
+  default:
+    return "unknown";
+  }
+}
+
+static double share(int64_t a, int64_t b) {
+  return b > 0 ? double(a) / double(b) : 0.0;
+}
+
+static string jsonString(const string& s) {
+  string out = "\"";
+  for (const auto c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buff[8];
+      snprintf(buff, sizeof(buff), "\\u%04x", c);
+      out += buff;
+    } else {
+      out += c;
+    }
+  }
+
+  return out + "\"";
+}
+
+static void printText(const fs::path& journalPath, const JFJournalInfo& info, const JFDryRun* dryRun) {
+  printf("journal      %s (%lld bytes)\n", journalPath.string().c_str(), (long long)info.fileSize);
+
+  if (info.fileSize == 0) {
+    printf("empty: clean shutdown, nothing to replay\n");
+    return;
+  }
+
+  printf("flag         %c (%s)\n", info.flag >= 0x20 && info.flag < 0x7F ? info.flag : '?', flagName(info.flag));
+  if (info.version > 0) {
+    printf("version      %d\n", info.version);
+    printf("blocks       %lld\n", (long long)info.numBlocks);
+  }
+
+  if (info.originalLength >= 0) {
+    printf("main length  %lld before the session\n", (long long)info.originalLength);
+  }
+
+  if (!info.blocks.empty()) {
+    printf("\n%6s %12s %10s %-8s %-8s %14s %10s %7s\n",
+      "#", "journal pos", "length", "type", "codec", "position", "raw bytes", "ranges");
+
+    for (size_t i = 0; i < info.blocks.size(); i++) {
+      const auto& block = info.blocks[i];
+      printf("%6zu %12lld %10lld %-8s %-8s %14lld %10lld %7zu\n",
+        i,
+        (long long)block.journalPos,
+        (long long)block.length,
+        jfblocktypename(block.type),
+        codecName(block.codec),
+        (long long)block.pos,
+        (long long)block.rawLength,
+        block.ranges.size());
+
+      if (block.type == kBlockCopy) {
+        printf("%6s from %s at %lld, %lld bytes\n",
+          "",
+          block.copySourcePath.empty() ? "the main file" : block.copySourcePath.c_str(),
+          (long long)block.copySourcePos,
+          (long long)(block.ranges.empty() ? 0 : block.ranges.front().length));
+      }
+    }
+
+    printf("\n");
+  }
+
+  if (info.trailingBytes > 0) {
+    printf("trailing     %lld bytes after the last block%s\n",
+      (long long)info.trailingBytes,
+      info.flag == kJournaling ? " (block being written, or left over)" : " (left over)");
+  }
+
+  printf("written      %lld bytes to the main file, %lld distinct\n",
+    (long long)info.writtenBytes, (long long)info.distinctBytes);
+  printf("redundant    %lld bytes (%.1f%%), %lld blocks overlap earlier ones\n",
+    (long long)info.redundantBytes,
+    share(info.redundantBytes, info.writtenBytes) * 100,
+    (long long)info.overlappingBlocks);
+  printf("amplification %.3fx journal bytes, %.3fx replay write bytes, per distinct byte\n",
+    share(info.fileSize - info.trailingBytes, info.distinctBytes),
+    share(info.replayWriteBytes, info.distinctBytes));
+  printf("replay       %llu reads (%lld bytes), %llu writes (%lld bytes), %lld bytes to decompress, 1 sync\n",
+    (unsigned long long)info.replayReads,
+    (long long)info.replayReadBytes,
+    (unsigned long long)info.replayWrites,
+    (long long)info.replayWriteBytes,
+    (long long)info.decompressBytes);
+
+  if (dryRun) {
+    printf("dry run      %.3f ms (%.3f ms decompressing), main file %lld -> %lld bytes\n",
+      dryRun->nanos / 1e6,
+      dryRun->decompressNanos / 1e6,
+      (long long)dryRun->sizeBefore,
+      (long long)dryRun->sizeAfter);
+  }
+
+  if (!info.error.empty()) {
+    printf("INVALID      %s\n", info.error.c_str());
+  }
+}
+
+static void printJson(const fs::path& journalPath, const JFJournalInfo& info, const JFDryRun* dryRun) {
+  printf("{\n");
+  printf("  \"journal\": %s,\n", jsonString(journalPath.string()).c_str());
+  printf("  \"valid\": %s,\n", info.error.empty() ? "true" : "false");
+  printf("  \"error\": %s,\n", info.error.empty() ? "null" : jsonString(info.error).c_str());
+  printf("  \"fileSize\": %lld,\n", (long long)info.fileSize);
+  printf("  \"flag\": \"%s\",\n", flagName(info.flag));
+  printf("  \"version\": %d,\n", info.version);
+  printf("  \"numBlocks\": %lld,\n", (long long)info.numBlocks);
+  printf("  \"originalLength\": %lld,\n", (long long)info.originalLength);
+  printf("  \"trailingBytes\": %lld,\n", (long long)info.trailingBytes);
+
+  printf("  \"blocks\": [");
+  for (size_t i = 0; i < info.blocks.size(); i++) {
+    const auto& block = info.blocks[i];
+    printf("%s\n    {\"journalPos\": %lld, \"length\": %lld, \"type\": \"%s\", \"codec\": \"%s\", "
+      "\"pos\": %lld, \"rawLength\": %lld, ",
+      i == 0 ? "" : ",",
+      (long long)block.journalPos,
+      (long long)block.length,
+      jfblocktypename(block.type),
+      codecName(block.codec),
+      (long long)block.pos,
+      (long long)block.rawLength);
+
+    if (block.type == kBlockCopy) {
+      printf("\"copySourcePath\": %s, \"copySourcePos\": %lld, ",
+        jsonString(block.copySourcePath).c_str(),
+        (long long)block.copySourcePos);
+    }
+
+    printf("\"ranges\": [");
+    for (size_t j = 0; j < block.ranges.size(); j++) {
+      printf("%s[%lld, %lld]", j == 0 ? "" : ", ", (long long)block.ranges[j].pos, (long long)block.ranges[j].length);
+    }
+
+    printf("], \"replayReads\": %llu, \"replayWrites\": %llu}",
+      (unsigned long long)block.replayReads,
+      (unsigned long long)block.replayWrites);
+  }
+
+  printf("%s],\n", info.blocks.empty() ? "" : "\n  ");
+
+  printf("  \"writtenBytes\": %lld,\n", (long long)info.writtenBytes);
+  printf("  \"distinctBytes\": %lld,\n", (long long)info.distinctBytes);
+  printf("  \"redundantBytes\": %lld,\n", (long long)info.redundantBytes);
+  printf("  \"overlappingBlocks\": %lld,\n", (long long)info.overlappingBlocks);
+  printf("  \"journalAmplification\": %.4f,\n", share(info.fileSize - info.trailingBytes, info.distinctBytes));
+  printf("  \"replayAmplification\": %.4f,\n", share(info.replayWriteBytes, info.distinctBytes));
+  printf("  \"replay\": {\"reads\": %llu, \"readBytes\": %lld, \"writes\": %llu, \"writeBytes\": %lld, "
+    "\"decompressBytes\": %lld, \"syncs\": 1}",
+    (unsigned long long)info.replayReads,
+    (long long)info.replayReadBytes,
+    (unsigned long long)info.replayWrites,
+    (long long)info.replayWriteBytes,
+    (long long)info.decompressBytes);
+
+  if (dryRun) {
+    printf(",\n  \"dryRun\": {\"nanos\": %llu, \"decompressNanos\": %llu, \"sizeBefore\": %lld, \"sizeAfter\": %lld}",
+      (unsigned long long)dryRun->nanos,
+      (unsigned long long)dryRun->decompressNanos,
+      (long long)dryRun->sizeBefore,
+      (long long)dryRun->sizeAfter);
+  }
+
+  printf("\n}\n");
+}
+
+static int usage() {
+  fputs("usage: jfio_inspect [--json] [--dry-run MAIN COPY] JOURNAL\n", stderr);
+  return 2;
+}
+
+int main(int argc, char** argv) {
+  bool json = false;
+  fs::path mainPath;
+  fs::path copyPath;
+  fs::path journalPath;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "--dry-run") == 0 && i + 2 < argc) {
+      mainPath = argv[++i];
+      copyPath = argv[++i];
+    } else if (argv[i][0] != '-' && journalPath.empty()) {
+      journalPath = argv[i];
+    } else {
+      return usage();
+    }
+  }
+
+  if (journalPath.empty()) {
+    return usage();
+  }
+
+  try {
+    const auto info = jfinspect(journalPath);
+
+    JFDryRun dryRun;
+    const auto doDryRun = !mainPath.empty() && info.error.empty();
+    if (doDryRun) {
+      dryRun = jfdryrun(mainPath, journalPath, copyPath);
+    }
+
+    if (json) {
+      printJson(journalPath, info, doDryRun ? &dryRun : nullptr);
+    } else {
+      printText(journalPath, info, doDryRun ? &dryRun : nullptr);
+    }
+
+    return info.error.empty() ? 0 : 1;
+  } catch (exception& e) {
+    fprintf(stderr, "jfio_inspect: %s\n", e.what());
+    return 2;
+  }
+}
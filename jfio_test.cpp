@@ -1,6 +1,10 @@
 #include <cstdio>
 
 #include "jfio/jfio.h"
+#include "jfio/jfscan.h"
+#include "jfio/jfpool.h"
+#include "jfio/jfkv.h"
+#include "jfio/jfinspect.h"
 #include "jfio/file2.h"
 
 namespace fs = std::filesystem;
@@ -15,15 +19,18 @@ void check(bool x, const char* msg) {
   }
 }
 
-JFile createTestFile() {
-  std::string filePath(1024, '\0');
-  tmpnam_s(filePath.data(), filePath.length());
-  std::string journalPath(1024, '\0');
-  tmpnam_s(journalPath.data(), journalPath.length());
+std::string createTestPath() {
+  std::string path(1024, '\0');
+  tmpnam_s(path.data(), path.length());
+  path.resize(strlen(path.c_str()));
+
+  return path;
+}
 
+JFile createTestFile() {
   return jfopen(
-    filesystem::path(filePath),
-    filesystem::path(journalPath),
+    filesystem::path(createTestPath()),
+    filesystem::path(createTestPath()),
     "rb+",
     "wb+"
   );
@@ -115,9 +122,791 @@ void testConsecutiveSeeks() {
   jfclose(file);
 }
 
+void testAppendFastPath() {
+  auto file = createTestFile();
+  jfputs("Hello", file);
+  jfflush(file);
+
+  jfputs(" world", file);
+  check(file.journalEndPos == 21, "Appended bytes should not be journaled");
+  jfclear(file);
+  check(jfseek(file, 0, SEEK_END) == 5, "jfclear should truncate appended bytes");
+
+  jfputs(" world", file);
+  jfseek(file, 0, SEEK_SET);
+  jfputc('h', file);
+  jfflush(file);
+
+  jfseek(file, 0, SEEK_SET);
+  string s(24, '\0');
+  check(jfgetn(s.data(), 20, file) == 11, "Num chars read mismatch");
+  check(strcmp(s.c_str(), "hello world") == 0, "String mismatch");
+
+  jfclose(file);
+}
+
+void testAppendRecovery() {
+  const auto filePath = createTestPath();
+  const auto journalPath = createTestPath();
+
+  auto file = jfopen(filePath, journalPath, "rb+", "wb+");
+  jfputs("Hello", file);
+  jfflush(file);
+  jfputs(", uncommitted", file);
+  // Simulate a crash: close the handles without committing
+  jfclose(file);
+
+  file = jfopen(filePath, journalPath, "rb+", "wb+");
+  check(jfseek(file, 0, SEEK_END) == 5, "Recovery should truncate appended bytes");
+
+  jfclose(file);
+}
+
+void testCopyRangeAndTruncate() {
+  auto file = createTestFile();
+  jfputs("Hello world", file);
+  jfflush(file);
+
+  jfcopyrange(file, 11, 0, 5);
+  jftruncate(file, 13);
+  check(jfseek(file, 0, SEEK_END) == 13, "jftruncate should shrink the file");
+
+  bool threw = false;
+  try {
+    jfseek(file, 0, SEEK_SET);
+    jfputc('h', file);
+  } catch (runtime_error&) {
+    threw = true;
+  }
+  check(threw, "Writing into a pending copy source should throw");
+
+  // Open the source by a relative path, and replay from another working directory
+  const auto cwd = fs::current_path();
+  const auto otherPath = fs::path(createTestPath());
+  fs::current_path(otherPath.parent_path());
+  auto other = jfopen(otherPath.filename(), fs::path(createTestPath()), "wb+", "");
+  jfputs("ABC", other);
+  jfflush(other);
+  jfcopyrange(file, 13, other, 1, 2);
+  fs::current_path(cwd.root_path());
+  jfclose(other);
+
+  // Replay could not open a source held exclusively
+  auto locked = jfopen(createTestPath(), createTestPath(), "wb+", "", SHARE_MODE_EXCLUSIVE);
+  jfputs("XYZ", locked);
+  jfflush(locked);
+  threw = false;
+  try {
+    jfcopyrange(file, 15, locked, 0, 1);
+  } catch (runtime_error&) {
+    threw = true;
+  }
+  check(threw, "Copying from an exclusive source should throw");
+  jfclose(locked);
+
+  jfflush(file);
+
+  jfseek(file, 0, SEEK_SET);
+  string s(24, '\0');
+  check(jfgetn(s.data(), 20, file) == 15, "Num chars read mismatch");
+  check(strcmp(s.c_str(), "Hello worldHeBC") == 0, "String mismatch");
+  fs::current_path(cwd);
+
+  jfclose(file);
+}
+
+void testBatch() {
+  auto file = createTestFile();
+  jfputs("0123456789", file);
+  jfflush(file);
+
+  const string a = "ab", c = "C", tail = "XYZW";
+  vector<JFWrite> writes = {
+    { 2, reinterpret_cast<const unsigned char*>(a.data()), a.size() },
+    { 8, reinterpret_cast<const unsigned char*>(tail.data()), tail.size() },
+    { 3, reinterpret_cast<const unsigned char*>(c.data()), c.size() },
+  };
+  jfputbatch(writes.data(), writes.size(), file);
+  check(jftell(file) == 10, "jfputbatch should not move the position");
+  check(jfseek(file, 0, SEEK_END) == 12, "jfputbatch should extend the file");
+
+  bool threw = false;
+  try {
+    const JFWrite hole = { 20, reinterpret_cast<const unsigned char*>(c.data()), c.size() };
+    jfputbatch(&hole, 1, file);
+  } catch (runtime_error&) {
+    threw = true;
+  }
+  check(threw, "jfputbatch should not leave holes");
+
+  jfflush(file);
+
+  jfseek(file, 0, SEEK_SET);
+  string s;
+  check(jfgetn(s, 100, file) == 12 && s == "01aC4567XYZW", "Batch content mismatch");
+
+  // Random scattered updates, some close enough to be coalesced at replay
+  string expected(64 * 1024, '.');
+  jfseek(file, 0, SEEK_SET);
+  jfputs(expected.data(), expected.size(), file);
+  jfflush(file);
+
+  srand(42);
+  string values;
+  values.reserve(4000 * 8);
+  writes.clear();
+  for (int i = 0; i < 4000; i++) {
+    const int64_t pos = rand() % (expected.size() + 4);
+    const auto offset = values.size();
+    for (int k = 0; k < 8; k++) {
+      values.push_back(char('a' + rand() % 26));
+    }
+
+    if (pos + 8 > int64_t(expected.size())) {
+      expected.resize(pos + 8);
+    }
+
+    expected.replace(pos, 8, values, offset, 8);
+    writes.push_back({ pos, reinterpret_cast<const unsigned char*>(values.data() + offset), 8 });
+  }
+
+  jfputbatch(writes.data(), writes.size(), file);
+  jfflush(file);
+
+  jfseek(file, 0, SEEK_SET);
+  s.clear();
+  jfgetn(s, expected.size() + 1, file);
+  check(s == expected, "Scattered batch content mismatch");
+
+  jfclose(file);
+}
+
+void testDelta() {
+  auto file = createTestFile();
+  string content(10000, 'A');
+  jfputs(content.data(), content.size(), file);
+  jfflush(file);
+
+  jfsetdelta(file, true);
+
+  // Rewrite everything, changing two bytes far apart
+  content[100] = 'B';
+  content[9000] = 'C';
+  jfseek(file, 0, SEEK_SET);
+  jfputs(content.data(), content.size(), file);
+  jfflush(file);
+  check(file.stats.deltaComparedBytes == 10000, "All bytes should be compared");
+  check(file.stats.deltaDroppedBytes >= 9000, "Unchanged bytes should be dropped");
+
+  jfseek(file, 0, SEEK_SET);
+  string s;
+  jfgetn(s, 20000, file);
+  check(s == content, "Delta content mismatch");
+
+  // Writing the original bytes back after a change in the same session must not be dropped
+  jfseek(file, 1000, SEEK_SET);
+  jfputs(string(100, 'X').c_str(), file);
+  jfseek(file, 1000, SEEK_SET);
+  jfputs(string(100, 'A').c_str(), file);
+  jfflush(file);
+
+  jfseek(file, 0, SEEK_SET);
+  s.clear();
+  jfgetn(s, 20000, file);
+  check(s == content, "Reverted bytes should be journaled");
+
+  jfclose(file);
+}
+
+void testCompression() {
+  for (int codec = kCodecNone; codec < kNumCodecs; codec++) {
+    auto file = createTestFile();
+    string content(100000, '.');
+    jfputs(content.data(), content.size(), file);
+    jfflush(file);
+
+    jfsetcompression(file, codec);
+
+    // Zeros, repetitive text, and bytes that do not compress
+    srand(42);
+    for (size_t i = 0; i < content.size(); i++) {
+      if (i < 30000) {
+        content[i] = '\0';
+      } else if (i < 60000) {
+        content[i] = "jfio journal "[i % 13];
+      } else {
+        content[i] = char(rand());
+      }
+    }
+
+    jfseek(file, 0, SEEK_SET);
+    jfputs(content.data(), content.size(), file);
+    jfseek(file, 5, SEEK_SET);
+    jfputs("short", file);
+    content.replace(5, 5, "short");
+
+    const auto journalBytes = file.journalEndPos;
+    jfflush(file);
+
+    if (codec == kCodecNone) {
+      check(journalBytes > int64_t(content.size()), "Uncompressed journal should hold every byte");
+    } else {
+      check(journalBytes < int64_t(content.size()) - 25000, "Compressed journal should be smaller");
+      check(file.stats.decompressNanos > 0, "Replay should decompress blocks");
+    }
+
+    jfseek(file, 0, SEEK_SET);
+    string s;
+    jfgetn(s, content.size() + 1, file);
+    check(s == content, "Compressed content mismatch");
+
+    jfclose(file);
+  }
+
+  // Large batches are split into compressed blocks that replay can bound
+  const auto filePath = createTestPath();
+  const auto journalPath = createTestPath();
+  auto file = jfopen(filePath, journalPath, "rb+", "wb+");
+  jfputs(string(300000, '.').c_str(), file);
+  jfflush(file);
+
+  jfsetcompression(file, kCodecLZ);
+  const string text(200000, 'z');
+  const JFWrite writes[] = { { 10, (const unsigned char*)text.data(), text.size() } };
+  jfputbatch(writes, 1, file);
+  jfflush(file);
+
+  jfseek(file, 10, SEEK_SET);
+  string s;
+  jfgetn(s, text.size(), file);
+  check(s == text, "Split batch content mismatch");
+
+  // Replay the same journal with a corrupt raw length in its first block
+  vector<unsigned char> journal(size_t(fs::file_size(journalPath)));
+  FILE* f = fopen(journalPath.c_str(), "rb");
+  check(fread(journal.data(), 1, journal.size(), f) == journal.size(), "Journal read failed");
+  fclose(f);
+  jfclose(file);
+
+  journal[0] = 'R';
+  const auto validJournal = journal;
+  memset(journal.data() + 21 + 17, 0x7F, 8);
+  f = fopen(journalPath.c_str(), "wb");
+  fwrite(journal.data(), 1, journal.size(), f);
+  fclose(f);
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool threw = false;
+    try {
+      file = jfopen(filePath, journalPath, "rb+", "wb+");
+    } catch (runtime_error&) {
+      threw = true;
+    }
+    check(threw, "A corrupt raw length should fail recovery, and keep failing while the journal is kept");
+  }
+
+  // The failed recovery should not leave readers waiting for it
+  auto reader = jfopen(filePath, journalPath, "rb", "", SHARE_MODE_READ_ONLY);
+  check(jfseek(reader, 0, SEEK_END) == 300000, "Reader should see the last committed length");
+  jfclose(reader);
+
+  // Once the journal is repaired, recovery completes
+  f = fopen(journalPath.c_str(), "wb");
+  fwrite(validJournal.data(), 1, validJournal.size(), f);
+  fclose(f);
+
+  file = jfopen(filePath, journalPath, "rb+", "wb+");
+  reader = jfopen(filePath, journalPath, "rb", "", SHARE_MODE_READ_ONLY);
+  jfseek(reader, 10, SEEK_SET);
+  s.clear();
+  jfgetn(s, text.size(), reader);
+  check(s == text, "Reader should see the recovered content");
+  jfclose(reader);
+  jfclose(file);
+}
+
+void testSavepoints() {
+  auto file = createTestFile();
+  jfputs("Hello", file);
+  jfflush(file);
+
+  // Appends before the savepoint must survive overwrites after it
+  jfputs(" world", file);
+  const auto outer = jfsavepoint(file);
+  jfseek(file, 0, SEEK_SET);
+  jfputs("J", file);
+  jfseek(file, 6, SEEK_SET);
+  jfputs("W", file);
+
+  const auto inner = jfsavepoint(file);
+  check(inner == outer + 1, "Savepoints should nest");
+  jfseek(file, 0, SEEK_END);
+  jfputs(", and more", file);
+  jftruncate(file, 3);
+
+  jfrollback(file, inner);
+  check(jftell(file) == 7, "Rollback should restore the position");
+  check(jfseek(file, 0, SEEK_END) == 11, "Rollback should restore the end of file");
+  jfputs("!", file);
+
+  jfrollback(file, outer);
+  check(jfseek(file, 0, SEEK_END) == 11, "Outer rollback end of file mismatch");
+  jfputs("?", file);
+
+  bool threw = false;
+  try {
+    jfrollback(file, inner);
+  } catch (runtime_error&) {
+    threw = true;
+  }
+  check(threw, "Rolling back to a dropped savepoint should throw");
+
+  jfrelease(file, outer);
+  jfflush(file);
+
+  jfseek(file, 0, SEEK_SET);
+  string s;
+  jfgetn(s, 100, file);
+  check(s == "Hello world?", "Savepoint content mismatch");
+
+  // A flush without writes still ends the session
+  jfsavepoint(file);
+  jfflush(file);
+  check(jfsavepoint(file) == 1 && file.savepoints.size() == 1, "Savepoint ids should restart after a flush");
+
+  jfclose(file);
+}
+
+void testVarintsAndRecords() {
+  auto file = createTestFile();
+  jfputvarint(0, file);
+  jfputvarint(300, file);
+  jfputvarint(UINT64_MAX, file);
+  jfputsvarint(-1, file);
+  jfputsvarint(INT64_MIN, file);
+  jfputrecord("record", 6, file);
+  jfputrecord("", 0, file);
+  jfflush(file);
+
+  check(jfseek(file, 0, SEEK_END) == 1 + 2 + 10 + 1 + 10 + 7 + 1, "Encoded size mismatch");
+  jfseek(file, 0, SEEK_SET);
+  check(jfgetvarint(file) == 0, "varint 0 mismatch");
+  check(jfgetvarint(file) == 300, "varint 300 mismatch");
+  check(jfgetvarint(file) == UINT64_MAX, "varint max mismatch");
+  check(jfgetsvarint(file) == -1, "svarint -1 mismatch");
+  check(jfgetsvarint(file) == INT64_MIN, "svarint min mismatch");
+
+  string s;
+  check(jfgetrecord(s, file) == 6 && s == "record", "Record mismatch");
+  check(jfgetrecord(s, file) == 0, "Empty record mismatch");
+  check(jfgetrecord(s, file) == EOF, "Expected EOF after the last record");
+
+  // Misaligned on the UINT64_MAX varint: the length does not fit the file
+  jfseek(file, 3, SEEK_SET);
+  bool threw = false;
+  try {
+    jfgetrecord(s, file);
+  } catch (runtime_error&) {
+    threw = true;
+  }
+  check(threw && s == "record" && jftell(file) == 3, "A corrupt record length should throw, leaving the buffer and position");
+
+  unsigned char buff[256];
+  uint64_t values[64];
+  uint64_t n = 0;
+  for (uint64_t i = 0; i < 40; i++) {
+    n += encodeVarint(i * i * i * i * i * i * 7, buff + n);
+  }
+
+  uint64_t consumed = 0;
+  check(decodeVarints(buff, n - 1, values, 64, consumed) == 39, "Bulk decode should stop at a partial varint");
+  check(decodeVarints(buff, n, values, 64, consumed) == 40 && consumed == n, "Bulk decode count mismatch");
+  for (uint64_t i = 0; i < 40; i++) {
+    check(values[i] == i * i * i * i * i * i * 7, "Bulk decode value mismatch");
+  }
+
+  jfclose(file);
+}
+
+/**
+ * Returns false if the open is refused.
+ */
+bool canOpen(const std::string& filePath, const std::string& journalPath, const char* mode, int shareMode) {
+  try {
+    auto file = jfopen(filePath, journalPath, mode, "", shareMode);
+    jfclose(file);
+    return true;
+  } catch (std::runtime_error&) {
+    return false;
+  }
+}
+
+void testShareModes() {
+  const auto filePath = createTestPath();
+  const auto journalPath = createTestPath();
+
+  auto writer = jfopen(filePath, journalPath, "rb+", "wb+");
+  jfputs("Hello", writer);
+  jfflush(writer);
+
+  check(!canOpen(filePath, journalPath, "rb+", SHARE_MODE_WRITING_SHARE_READ), "Second writer should be refused");
+  check(!canOpen(filePath, journalPath, "wb+", SHARE_MODE_WRITING_SHARE_READ), "Refused writer should not truncate");
+  check(!canOpen(filePath, journalPath, "rb+", SHARE_MODE_EXCLUSIVE), "Exclusive open should be refused");
+  check(canOpen(filePath, journalPath, "rb", SHARE_MODE_READ_ONLY), "Readers should share with the writer");
+
+  auto reader = jfopen(filePath, journalPath, "rb", "", SHARE_MODE_READ_ONLY);
+  check(jfseek(reader, 0, SEEK_END) == 5, "Refused opens should not change the file");
+  jfclose(writer);
+
+  check(!canOpen(filePath, journalPath, "rb+", SHARE_MODE_EXCLUSIVE), "Exclusive open should wait for readers");
+  jfclose(reader);
+
+  auto exclusive = jfopen(filePath, journalPath, "rb+", "", SHARE_MODE_EXCLUSIVE);
+  check(!canOpen(filePath, journalPath, "rb", SHARE_MODE_READ_ONLY), "Readers should be refused by exclusive opens");
+  jfclose(exclusive);
+
+  // A read mode exclusive open only fails if somebody holds the file
+  auto readExclusive = jfopen(filePath, journalPath, "rb", "", SHARE_MODE_EXCLUSIVE);
+  check(!canOpen(filePath, journalPath, "rb+", SHARE_MODE_WRITING_SHARE_READ), "Writers should be refused by exclusive opens");
+  check(!canOpen(filePath, journalPath, "rb", SHARE_MODE_READ_ONLY), "Readers should be refused by exclusive opens");
+  jfclose(readExclusive);
+}
+
+void testCommitCounter() {
+  const auto filePath = createTestPath();
+  const auto journalPath = createTestPath();
+
+  auto writer = jfopen(filePath, journalPath, "rb+", "wb+");
+  jfputs("Hello", writer);
+  jfflush(writer);
+
+  auto reader = jfopen(filePath, journalPath, "rb", "", SHARE_MODE_READ_ONLY);
+  const auto commits = jfcommitcount(reader);
+  std::string s;
+  check(jfgetn(s, 100, reader) == 5 && s == "Hello", "Reader should see the committed data");
+
+  // Appends go straight to the main file, but are not committed yet
+  jfputs(", World", writer);
+  jfseek(reader, 0, SEEK_SET);
+  s.clear();
+  check(jfgetn(s, 100, reader) == 5 && s == "Hello", "Reader should not see uncommitted appends");
+  check(jfseek(reader, 0, SEEK_END) == 5, "Reader should see the committed length");
+  check(jfcommitcount(reader) == commits, "Nothing should be committed yet");
+
+  jfseek(writer, 0, SEEK_SET);
+  jfputc('J', writer);
+  jfflush(writer);
+  check(jfcommitcount(reader) == commits + 1, "Reader should see the commit");
+
+  jfseek(reader, 0, SEEK_SET);
+  s.clear();
+  check(jfgetn(s, 100, reader) == 12 && s == "Jello, World", "Reader should see the new commit");
+
+  // A commit failing halfway should not leave readers waiting for it
+  const auto sourcePath = createTestPath();
+  auto source = jfopen(sourcePath, createTestPath(), "wb+", "");
+  jfputs("!", source);
+  jfflush(source);
+  jfcopyrange(writer, 12, source, 0, 1);
+  jfclose(source);
+  fs::remove(sourcePath);
+
+  bool threw = false;
+  try {
+    jfflush(writer);
+  } catch (runtime_error&) {
+    threw = true;
+  }
+  check(threw, "Replaying a copy from a missing source should throw");
+
+  jfseek(reader, 0, SEEK_SET);
+  s.clear();
+  check(jfgetn(s, 100, reader) == 12 && s == "Jello, World", "Reader should keep the previous commit");
+  jfclose(writer);
+
+  // The journal is kept, so the commit completes on the next open
+  FILE* f = fopen(sourcePath.c_str(), "wb");
+  fputs("!", f);
+  fclose(f);
+  writer = jfopen(filePath, journalPath, "rb+", "wb+");
+  jfseek(reader, 0, SEEK_SET);
+  s.clear();
+  check(jfgetn(s, 100, reader) == 13 && s == "Jello, World!", "Reader should see the recovered commit");
+
+  jfclose(reader);
+  jfclose(writer);
+}
+
+template<typename _t_backend>
+void testBackend() {
+  const auto filePath = createTestPath();
+  const auto journalPath = createTestPath();
+
+  auto file = jfopen<_t_backend>(filePath, journalPath, "rb+", "wb+");
+  jfputs("Hello world", file);
+  jfputi64(42, file);
+  jfflush(file);
+
+  jfseek(file, 6, SEEK_SET);
+  jfputs("W", file);
+  jfseek(file, 0, SEEK_END);
+  jfputs("!!", file);
+  jfflush(file);
+
+  jfputs("uncommitted", file);
+  jfclose(file);
+
+  file = jfopen<_t_backend>(filePath, journalPath, "rb+", "wb+");
+  check(jfseek(file, 0, SEEK_END) == 21, "File size mismatch");
+
+  jfseek(file, 0, SEEK_SET);
+  string s;
+  check(jfgetn(s, 11, file) == 11, "Num chars read mismatch");
+  check(s == "Hello World", "String mismatch");
+  check(jfgeti64(file) == 42, "i64 mismatch");
+  check(jfgetc(file) == '!', "jfgetc() != !");
+
+  jfclose(file);
+}
+
+template<typename _t_backend>
+void testScan() {
+  auto file = jfopen<_t_backend>(createTestPath(), createTestPath(), "rb+", "wb+");
+
+  string content;
+  for (int i = 0; content.size() < 300000; i++) {
+    content += to_string(i) + ",";
+  }
+
+  jfputs(content.c_str(), content.size(), file);
+  jfflush(file);
+
+  jfseek(file, 0, SEEK_SET);
+  auto scan = jfscanopen(file, 4096, 3);
+
+  string scanned;
+  const unsigned char* data = nullptr;
+  uint64_t length = 0;
+  while (jfscannext(scan, data, length)) {
+    scanned.append(reinterpret_cast<const char*>(data), length);
+  }
+
+  check(scanned == content, "Scanned content mismatch");
+  check(jftell(file) == int64_t(content.size()), "jftell() after scan mismatch");
+
+  jfscanseek(scan, 100000);
+  check(jfscannext(scan, data, length), "Expected data after seek");
+  check(memcmp(data, content.data() + 100000, length) == 0, "Content after seek mismatch");
+  jfscanclose(scan);
+
+  // Stop early, with chunks still being read ahead
+  scan = jfscanopen(file, 1024, 4);
+  check(jfscannext(scan, data, length) && length == 1024, "Chunk length mismatch");
+  jfscanclose(scan);
+
+  jfclose(file);
+}
+
+void testPool() {
+  auto pool = jfpoolopen(2);
+
+  vector<string> paths;
+  for (int i = 0; i < 3; i++) {
+    paths.push_back(createTestPath());
+    auto& file = jfpoolget(pool, paths[i], paths[i] + ".journal", "wb+", "");
+    jfputs(("File " + to_string(i)).c_str(), file);
+    jfflush(file);
+    jfseek(file, 2, SEEK_SET);
+  }
+
+  check(pool.lru.size() == 2 && pool.evictions == 1, "The pool should stay within its limit");
+  check(fs::file_size(paths[0] + ".journal") == 0, "A clean close should empty the journal");
+
+  // Reopened without truncating, at the same position
+  auto& first = jfpoolget(pool, paths[0], paths[0] + ".journal", "wb+", "");
+  check(jftell(first) == 2, "Reopen should restore the position");
+  string s;
+  jfgetn(s, 100, first);
+  check(s == "le 0", "Reopened content mismatch");
+  check(first.lastPersistedMaxPos == 6, "Reopen should keep the committed end of file");
+
+  // jfclear goes back to the position of the last commit, not to the reopen's
+  jfclear(first);
+  check(jftell(first) == 6, "Reopen should restore the committed position");
+
+  // Files with uncommitted writes stay open
+  jfputs("x", jfpoolget(pool, paths[1], paths[1] + ".journal", "", ""));
+  jfputs("y", jfpoolget(pool, paths[2], paths[2] + ".journal", "", ""));
+  bool threw = false;
+  try {
+    jfpoolget(pool, paths[0], paths[0] + ".journal", "", "");
+  } catch (runtime_error&) {
+    threw = true;
+  }
+  check(threw, "A pool full of uncommitted files should throw");
+
+  jfflush(jfpoolget(pool, paths[2], paths[2] + ".journal", "", ""));
+  auto& third = jfpoolget(pool, paths[2], paths[2] + ".journal", "", "");
+  jfseek(third, 0, SEEK_SET);
+  s.clear();
+  jfgetn(s, 100, third);
+  check(s == "Fiye 2", "Pooled write mismatch");
+
+  jfpoolclose(pool);
+}
+
+void testKV() {
+  const auto filePath = createTestPath();
+  const auto journalPath = createTestPath();
+
+  auto kv = jfkvopen(filePath, journalPath, 4);
+  jfkvput(kv, "alpha", "1");
+  jfkvput(kv, "beta", "2");
+
+  string value;
+  check(jfkvget(kv, "alpha", value) && value == "1", "Staged put should be visible");
+  jfkvrollback(kv);
+  check(!jfkvget(kv, "alpha", value), "Rolled back put should be gone");
+
+  // Enough keys to rebuild the index a few times
+  vector<JFKVItem> items(5000);
+  for (size_t i = 0; i < items.size(); i++) {
+    items[i].key = "key" + to_string(i);
+    items[i].value = string(i % 50, char('a' + i % 26));
+  }
+
+  jfkvputbatch(kv, items.data(), 2000);
+  jfkvcommit(kv);
+  jfkvputbatch(kv, items.data() + 2000, items.size() - 2000);
+  jfkvcommit(kv);
+  check(jfkvsize(kv) == 5000, "Size mismatch");
+
+  // Grow some values, shrink others, delete every third key, all in one commit
+  for (size_t i = 0; i < items.size(); i++) {
+    if (i % 3 == 0) {
+      jfkvdelete(kv, items[i].key);
+    } else {
+      items[i].value = i % 2 ? string(200, 'x') : "y";
+      jfkvput(kv, items[i].key, items[i].value);
+    }
+  }
+
+  jfkvcommit(kv);
+  jfkvclose(kv);
+
+  kv = jfkvopen(filePath, journalPath, 4);
+  check(jfkvsize(kv) == 5000 - 1667, "Size after deletes mismatch");
+
+  auto lookups = items;
+  jfkvgetbatch(kv, lookups.data(), lookups.size());
+  for (size_t i = 0; i < lookups.size(); i++) {
+    check(lookups[i].found == (i % 3 != 0), "Found mismatch");
+    check(i % 3 == 0 || lookups[i].value == items[i].value, "Value mismatch");
+  }
+
+  // Freed blocks are reused
+  const auto size = jfseek(kv.file, 0, SEEK_END);
+  for (int round = 0; round < 3; round++) {
+    for (size_t i = 0; i < items.size(); i += 3) {
+      jfkvput(kv, items[i].key, string(200, 'z'));
+    }
+    jfkvcommit(kv);
+
+    jfkvdeletebatch(kv, &items[0].key, 1);
+    for (size_t i = 0; i < items.size(); i += 3) {
+      jfkvdelete(kv, items[i].key);
+    }
+    jfkvcommit(kv);
+  }
+  check(jfseek(kv.file, 0, SEEK_END) < size + 1024 * 1024, "Deleted space should be reused");
+
+  jfkvclose(kv);
+}
+
+void testInspect() {
+  const auto filePath = createTestPath();
+  const auto journalPath = createTestPath();
+
+  auto file = jfopen(filePath, journalPath, "rb+", "wb+");
+  jfputs(string(1000, 'a').c_str(), file);
+  jfflush(file);
+
+  // Two overlapping writes, then a truncate cutting the second one
+  jfseek(file, 0, SEEK_SET);
+  jfputs(string(100, 'b').c_str(), file);
+  jfseek(file, 50, SEEK_SET);
+  jfputs(string(100, 'c').c_str(), file);
+  jftruncate(file, 120);
+  jfflush(file);
+
+  // The committed journal stays until the file is closed
+  auto info = jfinspect(journalPath);
+  check(info.error.empty() && info.flag != 'J' && info.version == 3, "Journal header mismatch");
+  check(info.numBlocks == int64_t(info.blocks.size()) && info.blocks.size() == 3, "Block count mismatch");
+  check(info.writtenBytes == 200 && info.distinctBytes == 120, "Redundancy mismatch");
+  check(info.overlappingBlocks == 1 && info.replayWrites == 3, "Replay estimate mismatch");
+
+  const auto copyPath = createTestPath();
+  const auto dryRun = jfdryrun(filePath, journalPath, copyPath);
+  check(dryRun.sizeBefore == 120 && dryRun.sizeAfter == 120, "Dry run size mismatch");
+
+  // Never overwrite the originals, or an earlier copy
+  for (const auto& target : { filePath, journalPath, copyPath }) {
+    bool threw = false;
+    try {
+      jfdryrun(filePath, journalPath, target);
+    } catch (runtime_error&) {
+      threw = true;
+    }
+    check(threw, "A dry run onto an existing file should throw");
+  }
+
+  check(fs::file_size(filePath) == 120, "A refused dry run should not touch the main file");
+  jfclose(file);
+
+  auto copy = jfopen(copyPath, "", "rb", "", SHARE_MODE_READ_ONLY);
+  string s;
+  jfgetn(s, 200, copy);
+  check(s == string(50, 'b') + string(70, 'c'), "Dry run content mismatch");
+  jfclose(copy);
+
+  // A corrupt block length is reported, not thrown
+  {
+    auto jf = StdioBackend::open(journalPath, "wb+", "", SHARE_MODE_EXCLUSIVE);
+    const unsigned char header[] = { 'R', 0, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 99 };
+    jf.write(0, header, sizeof(header));
+    jf.close();
+  }
+
+  info = jfinspect(journalPath);
+  check(!info.error.empty() && info.blocks.empty(), "A corrupt journal should be reported");
+}
+
 int main() {
   testSimpleWrite();
   testWrite();
   testNumbers();
   testConsecutiveSeeks();
+  testAppendFastPath();
+  testAppendRecovery();
+  testCopyRangeAndTruncate();
+  testBatch();
+  testDelta();
+  testCompression();
+  testSavepoints();
+  testVarintsAndRecords();
+  testShareModes();
+#ifndef WIN32
+  testCommitCounter();
+#endif
+  testBackend<StdioBackend>();
+#ifndef WIN32
+  testBackend<FdBackend>();
+#endif
+  testBackend<MemoryBackend>();
+  testScan<StdioBackend>();
+  testScan<MemoryBackend>();
+  testPool();
+  testKV();
+  testInspect();
 }
\ No newline at end of file
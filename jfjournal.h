@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include "varint.h"
+
+namespace jfio {
+
+// On-disk layout of the journal, shared by jfio.cpp and jfinspect.cpp.
+//
+// Header: flag (1 byte), version (4 bytes), number of completed blocks (8 bytes),
+// then, from version 2, the original main file length (8 bytes).
+// Every block: block length (8 bytes, header included), position (8 bytes),
+// then, from version 3, the type byte. The content follows.
+// Integers are big endian.
+
+constexpr int kJournaling = 'J';
+constexpr int kJournalReady = 'R';
+constexpr int kJournalCleared = 'C';
+constexpr int kFlagBytes = 1;
+constexpr int kVersionBytes = 4;
+constexpr int32_t kJournalVersion = 3;
+
+// Block types (journal version 3+)
+constexpr int kBlockData = 0;
+constexpr int kBlockCopy = 1;
+constexpr int kBlockTruncate = 2;
+constexpr int kBlockBatch = 3;
+
+// The type byte holds the block type in its low bits,
+// and the codec of the content (see jfcompress.h) in its high bits.
+constexpr int kBlockTypeMask = 0x0F;
+constexpr int kBlockCodecShift = 4;
+
+// Compressed blocks hold at most this many bytes of written data (see journalBatch),
+// so their raw length is bounded by the data plus a batch table of one range per byte.
+// Replay refuses larger lengths instead of allocating them.
+constexpr int64_t kMaxCompressedDataBytes = 64 * 1024;
+constexpr int64_t kMaxCompressedRawBytes = 8 + kMaxVarintBytes * (1 + 2 * kMaxCompressedDataBytes) + kMaxCompressedDataBytes;
+
+// Chunk size used when replaying data blocks
+constexpr int64_t kReplayChunkBytes = 64 * 1024;
+
+// Batch ranges closer than this are replayed as one read-patch-write,
+// since a small write dirties the whole page anyway.
+constexpr int64_t kBatchCoalesceGapBytes = 4096;
+
+static inline void encodeI32(int32_t i32, unsigned char* buff) {
+  for (int i = 0; i < 4; i++) {
+    buff[i] = static_cast<unsigned char>((i32 >> (24 - i * 8)) & 0xFF);
+  }
+}
+
+static inline void encodeI64(int64_t i64, unsigned char* buff) {
+  for (int i = 0; i < 8; i++) {
+    buff[i] = static_cast<unsigned char>((i64 >> (56 - i * 8)) & 0xFF);
+  }
+}
+
+static inline int64_t decodeInt(const unsigned char* buff, int numBytes) {
+  int64_t result = 0;
+  for (int i = 0; i < numBytes; i++) {
+    result <<= 8;
+    result |= buff[i];
+  }
+
+  return result;
+}
+
+}
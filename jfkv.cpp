@@ -0,0 +1,704 @@
+#include "jfkv.h"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include "jfio.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace jfio {
+
+constexpr unsigned char kKVMagic[4] = { 'J', 'F', 'K', 'V' };
+constexpr int32_t kKVVersion = 1;
+
+// Header: magic (4), version (4), 5 fields (8 each), free lists (8 each).
+// Room is left for more fields.
+constexpr int64_t kKVHeaderBytes = 512;
+constexpr int64_t kKVHeaderUsedBytes = 8 + 5 * 8 + kKVNumClasses * 8;
+
+// Slot: key hash (8), record offset (8)
+constexpr int64_t kKVSlotBytes = 16;
+constexpr int64_t kKVEmpty = 0;
+constexpr int64_t kKVTombstone = -1;
+
+// Record: capacity (4), key length (4), value length (4), key, value
+constexpr int64_t kKVRecordHeaderBytes = 12;
+constexpr int kKVMaxRecordClass = 31;
+
+// Smallest block: a record header and a few bytes
+constexpr int kKVMinClass = 5;
+
+constexpr int64_t kKVMinBuckets = 1024;
+constexpr int64_t kKVPageSlots = 256;
+
+// Value bytes read along with the key, so small values take a single read
+constexpr int64_t kKVValueReadAhead = 128;
+
+static inline void encodeBE(uint64_t value, int numBytes, unsigned char* buff) {
+  for (int i = 0; i < numBytes; i++) {
+    buff[i] = static_cast<unsigned char>((value >> ((numBytes - 1 - i) * 8)) & 0xFF);
+  }
+}
+
+static inline uint64_t decodeBE(const unsigned char* buff, int numBytes) {
+  uint64_t result = 0;
+  for (int i = 0; i < numBytes; i++) {
+    result = (result << 8) | buff[i];
+  }
+
+  return result;
+}
+
+static inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+/**
+ * Stored in the index, so it must not change across platforms.
+ */
+static inline uint64_t keyHash(const string& key) {
+  const auto data = reinterpret_cast<const unsigned char*>(key.data());
+  const auto n = key.size();
+
+  uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    h = mix64(h ^ loadLittleEndian64(data + i));
+  }
+
+  uint64_t tail = 0;
+  for (size_t k = n; k > i; k--) {
+    tail = (tail << 8) | data[k - 1];
+  }
+
+  return mix64(h ^ tail ^ 0x2545F4914F6CDD1DULL);
+}
+
+static inline int sizeClass(int64_t bytes) {
+  int c = kKVMinClass;
+  while ((int64_t(1) << c) < bytes) {
+    c++;
+  }
+
+  return c;
+}
+
+struct KVSlot {
+  uint64_t hash = 0;
+  int64_t offset = kKVEmpty;
+};
+
+static inline KVSlot decodeSlot(const unsigned char* buff) {
+  KVSlot slot;
+  slot.hash = decodeBE(buff, 8);
+  slot.offset = int64_t(decodeBE(buff + 8, 8));
+  return slot;
+}
+
+static inline void encodeSlot(const KVSlot& slot, unsigned char* buff) {
+  encodeBE(slot.hash, 8, buff);
+  encodeBE(uint64_t(slot.offset), 8, buff + 8);
+}
+
+static inline void encodeHeader(const JFKVHeader& header, unsigned char* buff) {
+  memcpy(buff, kKVMagic, 4);
+  encodeBE(kKVVersion, 4, buff + 4);
+  encodeBE(header.bucketCount, 8, buff + 8);
+  encodeBE(header.indexOffset, 8, buff + 16);
+  encodeBE(header.numEntries, 8, buff + 24);
+  encodeBE(header.numTombstones, 8, buff + 32);
+  encodeBE(header.heapEnd, 8, buff + 40);
+  for (int c = 0; c < kKVNumClasses; c++) {
+    encodeBE(header.freeLists[c], 8, buff + 48 + c * 8);
+  }
+}
+
+static inline JFKVHeader decodeHeader(const unsigned char* buff) {
+  if (memcmp(buff, kKVMagic, 4) != 0 || int32_t(decodeBE(buff + 4, 4)) != kKVVersion) {
+    throw runtime_error("jfkvopen: not a key-value store");
+  }
+
+  JFKVHeader header;
+  header.bucketCount = int64_t(decodeBE(buff + 8, 8));
+  header.indexOffset = int64_t(decodeBE(buff + 16, 8));
+  header.numEntries = int64_t(decodeBE(buff + 24, 8));
+  header.numTombstones = int64_t(decodeBE(buff + 32, 8));
+  header.heapEnd = int64_t(decodeBE(buff + 40, 8));
+  for (int c = 0; c < kKVNumClasses; c++) {
+    header.freeLists[c] = int64_t(decodeBE(buff + 48 + c * 8, 8));
+  }
+
+  return header;
+}
+
+/**
+ * Reads up to n committed bytes at pos. Returns the number of bytes read.
+ */
+template<typename _t_backend>
+static inline uint64_t readAt(BasicJFKV<_t_backend>& kv, int64_t pos, void* buff, uint64_t n) {
+  jfseek(kv.file, pos, SEEK_SET);
+  const auto bytesRead = jfgetn(static_cast<char*>(buff), n, kv.file);
+  return bytesRead < 0 ? 0 : uint64_t(bytesRead);
+}
+
+template<typename _t_backend>
+static inline void readExactly(BasicJFKV<_t_backend>& kv, int64_t pos, void* buff, uint64_t n) {
+  if (readAt(kv, pos, buff, n) != n) {
+    throw runtime_error("jfkv: unexpected end of file");
+  }
+}
+
+/**
+ * Committed slot, through the cache of index pages.
+ */
+template<typename _t_backend>
+static inline KVSlot cachedSlot(BasicJFKV<_t_backend>& kv, int64_t index) {
+  const auto page = index / kKVPageSlots;
+
+  auto it = kv.cache.find(page);
+  if (it != kv.cache.end()) {
+    kv.stats.cacheHits++;
+    kv.lru.splice(kv.lru.begin(), kv.lru, it->second.lru);
+  } else {
+    kv.stats.cacheMisses++;
+    if (kv.cache.size() >= kv.maxCachePages) {
+      kv.cache.erase(kv.lru.back());
+      kv.lru.pop_back();
+    }
+
+    JFKVCachePage cached;
+    cached.slots.resize(size_t(kKVPageSlots * kKVSlotBytes));
+    readExactly(kv, kv.header.indexOffset + page * kKVPageSlots * kKVSlotBytes, cached.slots.data(), cached.slots.size());
+
+    kv.lru.push_front(page);
+    cached.lru = kv.lru.begin();
+    it = kv.cache.emplace(page, move(cached)).first;
+  }
+
+  return decodeSlot(it->second.slots.data() + (index % kKVPageSlots) * kKVSlotBytes);
+}
+
+struct KVRecord {
+  int64_t capacity = 0;
+  int64_t valueLength = 0;
+};
+
+/**
+ * Reads the committed record at offset if its key is key.
+ * If value is given, the value is read into it as well.
+ */
+template<typename _t_backend>
+static inline bool readRecord(
+  BasicJFKV<_t_backend>& kv,
+  int64_t offset,
+  const string& key,
+  KVRecord& record,
+  string* value
+) {
+  const auto keyEnd = kKVRecordHeaderBytes + int64_t(key.size());
+
+  unsigned char buff[kKVRecordHeaderBytes + 256 + kKVValueReadAhead];
+  vector<unsigned char> large;
+  auto data = buff;
+  auto n = uint64_t(keyEnd + (value ? kKVValueReadAhead : 0));
+  if (n > sizeof(buff)) {
+    large.resize(size_t(n));
+    data = large.data();
+  }
+
+  const auto bytesRead = readAt(kv, offset, data, n);
+  if (bytesRead < uint64_t(kKVRecordHeaderBytes)) {
+    throw runtime_error("jfkv: unexpected end of file");
+  }
+
+  if (int64_t(decodeBE(data + 4, 4)) != int64_t(key.size()) || bytesRead < uint64_t(keyEnd) ||
+    memcmp(data + kKVRecordHeaderBytes, key.data(), key.size()) != 0) {
+    return false;
+  }
+
+  record.capacity = int64_t(decodeBE(data, 4));
+  record.valueLength = int64_t(decodeBE(data + 8, 4));
+
+  if (value) {
+    value->resize(size_t(record.valueLength));
+    const auto inBuffer = min<uint64_t>(uint64_t(record.valueLength), bytesRead - keyEnd);
+    memcpy(&(*value)[0], data + keyEnd, size_t(inBuffer));
+    if (inBuffer < uint64_t(record.valueLength)) {
+      readExactly(kv, offset + keyEnd + int64_t(inBuffer), &(*value)[inBuffer], record.valueLength - inBuffer);
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Looks up key in the committed store.
+ */
+template<typename _t_backend>
+static inline bool getCommitted(BasicJFKV<_t_backend>& kv, const string& key, string& value) {
+  const auto hash = keyHash(key);
+  const auto mask = kv.header.bucketCount - 1;
+
+  auto index = int64_t(hash) & mask;
+  for (int64_t probes = 0; probes < kv.header.bucketCount; probes++) {
+    const auto slot = cachedSlot(kv, index);
+    if (slot.offset == kKVEmpty) {
+      return false;
+    }
+
+    KVRecord record;
+    if (slot.offset != kKVTombstone && slot.hash == hash && readRecord(kv, slot.offset, key, record, &value)) {
+      return true;
+    }
+
+    index = (index + 1) & mask;
+  }
+
+  return false;
+}
+
+/**
+ * Everything a commit changes, built in memory before anything is written.
+ */
+struct KVCommit {
+  JFKVHeader header;
+
+  // Changed slots of the committed index
+  map<int64_t, KVSlot> slots;
+
+  // The whole index, when the commit rebuilds it
+  vector<KVSlot> index;
+
+  // Keys of the records allocated by this commit, by offset
+  unordered_map<int64_t, const string*> newKeys;
+
+  // Blocks freed by this commit: size class and offset.
+  // They only become reusable once the commit is done.
+  vector<pair<int, int64_t>> freed;
+
+  vector<pair<int64_t, vector<unsigned char>>> writes;
+};
+
+template<typename _t_backend>
+static inline KVSlot getSlot(BasicJFKV<_t_backend>& kv, KVCommit& commit, int64_t index) {
+  if (!commit.index.empty()) {
+    return commit.index[size_t(index)];
+  }
+
+  const auto it = commit.slots.find(index);
+  return it != commit.slots.end() ? it->second : cachedSlot(kv, index);
+}
+
+static inline void setSlot(KVCommit& commit, int64_t index, const KVSlot& slot) {
+  if (!commit.index.empty()) {
+    commit.index[size_t(index)] = slot;
+  } else {
+    commit.slots[index] = slot;
+  }
+}
+
+/**
+ * Takes a block of the size class from its free list, or from the end of the heap.
+ * atEnd tells whether the block grows the file.
+ */
+template<typename _t_backend>
+static inline int64_t allocate(BasicJFKV<_t_backend>& kv, KVCommit& commit, int sizeClass, bool& atEnd) {
+  auto& head = commit.header.freeLists[sizeClass];
+  if (head != 0) {
+    const auto offset = head;
+    unsigned char next[8];
+    readExactly(kv, offset, next, 8);
+    head = int64_t(decodeBE(next, 8));
+    atEnd = false;
+    return offset;
+  }
+
+  const auto offset = commit.header.heapEnd;
+  commit.header.heapEnd += int64_t(1) << sizeClass;
+  atEnd = true;
+  return offset;
+}
+
+/**
+ * Writes a record. Blocks at the end of the heap are written whole,
+ * so the file never has a hole past its end.
+ */
+static inline void writeRecord(
+  KVCommit& commit,
+  int64_t offset,
+  int64_t capacity,
+  const string& key,
+  const string& value,
+  bool atEnd
+) {
+  const auto length = kKVRecordHeaderBytes + int64_t(key.size() + value.size());
+  vector<unsigned char> record(size_t(atEnd ? capacity : length), 0);
+  encodeBE(uint64_t(capacity), 4, record.data());
+  encodeBE(key.size(), 4, record.data() + 4);
+  encodeBE(value.size(), 4, record.data() + 8);
+  memcpy(record.data() + kKVRecordHeaderBytes, key.data(), key.size());
+  memcpy(record.data() + kKVRecordHeaderBytes + key.size(), value.data(), value.size());
+
+  commit.writes.emplace_back(offset, move(record));
+}
+
+/**
+ * Moves the live slots to a new index with room for entries keys at 35% load.
+ * The old index goes back to the free lists.
+ */
+template<typename _t_backend>
+static inline void rebuildIndex(BasicJFKV<_t_backend>& kv, KVCommit& commit, int64_t entries) {
+  auto& header = commit.header;
+
+  auto bucketCount = max(kKVMinBuckets, header.bucketCount);
+  while (entries * 20 > bucketCount * 7) {
+    bucketCount *= 2;
+  }
+
+  vector<unsigned char> old(static_cast<size_t>(header.bucketCount * kKVSlotBytes));
+  readExactly(kv, header.indexOffset, old.data(), old.size());
+
+  commit.index.assign(size_t(bucketCount), KVSlot());
+  const auto mask = bucketCount - 1;
+  for (int64_t i = 0; i < header.bucketCount; i++) {
+    const auto slot = decodeSlot(old.data() + i * kKVSlotBytes);
+    if (slot.offset == kKVEmpty || slot.offset == kKVTombstone) {
+      continue;
+    }
+
+    auto index = int64_t(slot.hash) & mask;
+    while (commit.index[size_t(index)].offset != kKVEmpty) {
+      index = (index + 1) & mask;
+    }
+
+    commit.index[size_t(index)] = slot;
+  }
+
+  commit.freed.emplace_back(sizeClass(header.bucketCount * kKVSlotBytes), header.indexOffset);
+
+  bool atEnd = false;
+  header.indexOffset = allocate(kv, commit, sizeClass(bucketCount * kKVSlotBytes), atEnd);
+  header.bucketCount = bucketCount;
+  header.numTombstones = 0;
+
+  kv.stats.rehashes++;
+}
+
+/**
+ * Applies one staged change to the commit.
+ */
+template<typename _t_backend>
+static inline void applyChange(
+  BasicJFKV<_t_backend>& kv,
+  KVCommit& commit,
+  const string& key,
+  const JFKVChange& change
+) {
+  auto& header = commit.header;
+  const auto hash = keyHash(key);
+  const auto mask = header.bucketCount - 1;
+
+  int64_t found = -1;
+  int64_t firstFree = -1;
+  KVSlot foundSlot;
+  KVRecord record;
+
+  auto index = int64_t(hash) & mask;
+  for (int64_t probes = 0; probes < header.bucketCount; probes++) {
+    const auto slot = getSlot(kv, commit, index);
+    if (slot.offset == kKVEmpty) {
+      if (firstFree < 0) {
+        firstFree = index;
+      }
+
+      break;
+    }
+
+    if (slot.offset == kKVTombstone) {
+      if (firstFree < 0) {
+        firstFree = index;
+      }
+    } else if (slot.hash == hash) {
+      const auto it = commit.newKeys.find(slot.offset);
+      const auto matches = it != commit.newKeys.end()
+        ? *it->second == key
+        : readRecord(kv, slot.offset, key, record, nullptr);
+
+      if (matches) {
+        found = index;
+        foundSlot = slot;
+        break;
+      }
+    }
+
+    index = (index + 1) & mask;
+  }
+
+  if (change.deleted) {
+    if (found >= 0) {
+      setSlot(commit, found, { 0, kKVTombstone });
+      commit.freed.emplace_back(sizeClass(record.capacity), foundSlot.offset);
+      header.numEntries--;
+      header.numTombstones++;
+    }
+
+    return;
+  }
+
+  const auto length = kKVRecordHeaderBytes + int64_t(key.size() + change.value.size());
+  if (found >= 0 && length <= record.capacity) {
+    // Fits where it is
+    writeRecord(commit, foundSlot.offset, record.capacity, key, change.value, false);
+    return;
+  }
+
+  const auto recordClass = sizeClass(length);
+  if (recordClass > kKVMaxRecordClass) {
+    throw runtime_error("jfkvcommit: record too large");
+  }
+
+  bool atEnd = false;
+  const auto offset = allocate(kv, commit, recordClass, atEnd);
+  writeRecord(commit, offset, int64_t(1) << recordClass, key, change.value, atEnd);
+  commit.newKeys[offset] = &key;
+
+  if (found >= 0) {
+    commit.freed.emplace_back(sizeClass(record.capacity), foundSlot.offset);
+    setSlot(commit, found, { hash, offset });
+    return;
+  }
+
+  if (firstFree < 0) {
+    throw runtime_error("jfkvcommit: the index is full");
+  }
+
+  if (getSlot(kv, commit, firstFree).offset == kKVTombstone) {
+    header.numTombstones--;
+  }
+
+  setSlot(commit, firstFree, { hash, offset });
+  header.numEntries++;
+}
+
+template<typename _t_backend>
+BasicJFKV<_t_backend> jfkvopen(
+  const fs::path& mainFilePath,
+  const fs::path& journalFilePath,
+  uint64_t cachePages
+) {
+  BasicJFKV<_t_backend> kv;
+  kv.file = jfopen<_t_backend>(mainFilePath, journalFilePath, "rb+", "wb+", SHARE_MODE_EXCLUSIVE);
+  kv.maxCachePages = max<uint64_t>(cachePages, 1);
+
+  try {
+    unsigned char buff[kKVHeaderBytes] = {};
+    if (jfseek(kv.file, 0, SEEK_END) == 0) {
+      kv.header.bucketCount = kKVMinBuckets;
+      kv.header.indexOffset = kKVHeaderBytes;
+      kv.header.heapEnd = kKVHeaderBytes + kKVMinBuckets * kKVSlotBytes;
+
+      // The header, and an index of empty slots
+      vector<unsigned char> content(size_t(kv.header.heapEnd), 0);
+      encodeHeader(kv.header, content.data());
+      jfputs(content.data(), content.size(), kv.file);
+      jfflush(kv.file);
+    } else {
+      readExactly(kv, 0, buff, kKVHeaderUsedBytes);
+      kv.header = decodeHeader(buff);
+    }
+  } catch (runtime_error&) {
+    jfclose(kv.file);
+    throw;
+  }
+
+  return kv;
+}
+
+template<typename _t_backend>
+bool jfkvget(BasicJFKV<_t_backend>& kv, const string& key, string& value) {
+  const auto it = kv.changes.find(key);
+  if (it != kv.changes.end()) {
+    if (it->second.deleted) {
+      return false;
+    }
+
+    value = it->second.value;
+    return true;
+  }
+
+  return getCommitted(kv, key, value);
+}
+
+template<typename _t_backend>
+void jfkvput(BasicJFKV<_t_backend>& kv, const string& key, const string& value) {
+  auto& change = kv.changes[key];
+  change.deleted = false;
+  change.value = value;
+}
+
+template<typename _t_backend>
+void jfkvdelete(BasicJFKV<_t_backend>& kv, const string& key) {
+  auto& change = kv.changes[key];
+  change.deleted = true;
+  change.value.clear();
+}
+
+template<typename _t_backend>
+void jfkvgetbatch(BasicJFKV<_t_backend>& kv, JFKVItem* items, uint64_t n) {
+  const auto mask = uint64_t(kv.header.bucketCount - 1);
+
+  vector<pair<uint64_t, uint64_t>> order(static_cast<size_t>(n));
+  for (uint64_t i = 0; i < n; i++) {
+    order[size_t(i)] = { keyHash(items[i].key) & mask, i };
+  }
+
+  sort(order.begin(), order.end());
+
+  for (const auto& entry : order) {
+    auto& item = items[entry.second];
+    item.found = jfkvget(kv, item.key, item.value);
+  }
+}
+
+template<typename _t_backend>
+void jfkvputbatch(BasicJFKV<_t_backend>& kv, const JFKVItem* items, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    jfkvput(kv, items[i].key, items[i].value);
+  }
+}
+
+template<typename _t_backend>
+void jfkvdeletebatch(BasicJFKV<_t_backend>& kv, const string* keys, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    jfkvdelete(kv, keys[i]);
+  }
+}
+
+template<typename _t_backend>
+void jfkvcommit(BasicJFKV<_t_backend>& kv) {
+  if (kv.changes.empty()) {
+    return;
+  }
+
+  KVCommit commit;
+  commit.header = kv.header;
+
+  int64_t puts = 0;
+  for (const auto& item : kv.changes) {
+    puts += item.second.deleted ? 0 : 1;
+  }
+
+  // Assume every put is a new key, so the load stays below 70%
+  auto& header = commit.header;
+  if ((header.numEntries + header.numTombstones + puts) * 10 > header.bucketCount * 7) {
+    rebuildIndex(kv, commit, header.numEntries + puts);
+  }
+
+  for (const auto& item : kv.changes) {
+    applyChange(kv, commit, item.first, item.second);
+  }
+
+  for (const auto& block : commit.freed) {
+    vector<unsigned char> next(8);
+    encodeBE(uint64_t(header.freeLists[block.first]), 8, next.data());
+    commit.writes.emplace_back(block.second, move(next));
+    header.freeLists[block.first] = block.second;
+  }
+
+  if (!commit.index.empty()) {
+    vector<unsigned char> index(commit.index.size() * kKVSlotBytes);
+    for (size_t i = 0; i < commit.index.size(); i++) {
+      encodeSlot(commit.index[i], index.data() + i * kKVSlotBytes);
+    }
+
+    commit.writes.emplace_back(header.indexOffset, move(index));
+  }
+
+  for (const auto& slot : commit.slots) {
+    vector<unsigned char> buff(kKVSlotBytes);
+    encodeSlot(slot.second, buff.data());
+    commit.writes.emplace_back(header.indexOffset + slot.first * kKVSlotBytes, move(buff));
+  }
+
+  vector<unsigned char> headerBytes(kKVHeaderUsedBytes);
+  encodeHeader(header, headerBytes.data());
+  commit.writes.emplace_back(0, move(headerBytes));
+
+  vector<JFWrite> writes;
+  writes.reserve(commit.writes.size());
+  for (const auto& write : commit.writes) {
+    writes.push_back({ write.first, write.second.data(), write.second.size() });
+  }
+
+  try {
+    jfputbatch(writes.data(), writes.size(), kv.file);
+    jfflush(kv.file);
+  } catch (runtime_error&) {
+    jfclear(kv.file);
+    throw;
+  }
+
+  kv.header = header;
+  kv.changes.clear();
+  kv.stats.commits++;
+
+  if (!commit.index.empty()) {
+    kv.cache.clear();
+    kv.lru.clear();
+    return;
+  }
+
+  // Keep the cached pages in sync
+  for (const auto& slot : commit.slots) {
+    const auto it = kv.cache.find(slot.first / kKVPageSlots);
+    if (it != kv.cache.end()) {
+      encodeSlot(slot.second, it->second.slots.data() + (slot.first % kKVPageSlots) * kKVSlotBytes);
+    }
+  }
+}
+
+template<typename _t_backend>
+void jfkvrollback(BasicJFKV<_t_backend>& kv) {
+  kv.changes.clear();
+}
+
+template<typename _t_backend>
+int64_t jfkvsize(const BasicJFKV<_t_backend>& kv) {
+  return kv.header.numEntries;
+}
+
+template<typename _t_backend>
+void jfkvclose(BasicJFKV<_t_backend>& kv) {
+  kv.changes.clear();
+  kv.cache.clear();
+  kv.lru.clear();
+  jfclose(kv.file);
+}
+
+#define JFKV_INSTANTIATE(B) \
+  template BasicJFKV<B> jfkvopen(const fs::path&, const fs::path&, uint64_t); \
+  template bool jfkvget(BasicJFKV<B>&, const string&, string&); \
+  template void jfkvput(BasicJFKV<B>&, const string&, const string&); \
+  template void jfkvdelete(BasicJFKV<B>&, const string&); \
+  template void jfkvgetbatch(BasicJFKV<B>&, JFKVItem*, uint64_t); \
+  template void jfkvputbatch(BasicJFKV<B>&, const JFKVItem*, uint64_t); \
+  template void jfkvdeletebatch(BasicJFKV<B>&, const string*, uint64_t); \
+  template void jfkvcommit(BasicJFKV<B>&); \
+  template void jfkvrollback(BasicJFKV<B>&); \
+  template int64_t jfkvsize(const BasicJFKV<B>&); \
+  template void jfkvclose(BasicJFKV<B>&);
+
+JFKV_INSTANTIATE(StdioBackend)
+JFKV_INSTANTIATE(MemoryBackend)
+#ifndef WIN32
+JFKV_INSTANTIATE(FdBackend)
+#endif
+
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <filesystem>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "jfile.h"
+
+namespace jfio {
+
+// A key-value store in a single journaled file.
+//
+// Layout: a header, an open addressing hash index (linear probing, 16 byte
+// slots: key hash and record offset), and a heap of records (capacity, key
+// length, value length, key, value). Record and index space comes in power
+// of two size classes, and freed blocks go on a free list per class.
+//
+// Changes are staged in memory and written by jfkvcommit as one batch
+// journal block, committed with jfflush: either all of them survive a crash,
+// or none do.
+
+constexpr int kKVNumClasses = 48;
+constexpr uint64_t kDefaultKVCachePages = 1024;
+
+struct JFKVHeader {
+  int64_t bucketCount = 0;
+  int64_t indexOffset = 0;
+  int64_t numEntries = 0;
+  int64_t numTombstones = 0;
+
+  // End of the allocated space, which is the end of the file.
+  int64_t heapEnd = 0;
+
+  // First free block of each size class, 0 if none.
+  int64_t freeLists[kKVNumClasses] = {};
+};
+
+/**
+ * A staged put (or delete) of the current transaction.
+ */
+struct JFKVChange {
+  bool deleted = false;
+  std::string value;
+};
+
+/**
+ * A page of index slots held in memory.
+ */
+struct JFKVCachePage {
+  std::vector<unsigned char> slots;
+
+  // Position in the cache's LRU list.
+  std::list<int64_t>::iterator lru;
+};
+
+/**
+ * Counters since the store was opened.
+ */
+struct JFKVStats {
+  uint64_t cacheHits = 0;
+  uint64_t cacheMisses = 0;
+  uint64_t commits = 0;
+  uint64_t rehashes = 0;
+};
+
+template<typename _t_backend>
+struct BasicJFKV {
+  BasicJFile<_t_backend> file;
+  JFKVHeader header;
+
+  // Changes not committed yet, by key.
+  std::unordered_map<std::string, JFKVChange> changes;
+
+  // Hot index pages, most recently used first in lru.
+  uint64_t maxCachePages = kDefaultKVCachePages;
+  std::unordered_map<int64_t, JFKVCachePage> cache;
+  std::list<int64_t> lru;
+
+  JFKVStats stats;
+};
+
+using JFKV = BasicJFKV<StdioBackend>;
+
+/**
+ * A key, with the value to put or the value found.
+ */
+struct JFKVItem {
+  std::string key;
+  std::string value;
+  bool found = false;
+};
+
+/**
+ * Opens the store, creating it if the file is empty or missing.
+ * Up to cachePages pages of 256 index slots are cached in memory.
+ * The file is opened exclusively, since the cache assumes nobody else changes it.
+ * Throws a runtime_error if the file is not a store.
+ */
+template<typename _t_backend = StdioBackend>
+BasicJFKV<_t_backend> jfkvopen(
+  const std::filesystem::path& mainFilePath,
+  const std::filesystem::path& journalFilePath,
+  uint64_t cachePages = kDefaultKVCachePages
+);
+
+/**
+ * Looks up key, including the changes of the current transaction.
+ * Returns false if it is not there.
+ */
+template<typename _t_backend>
+bool jfkvget(BasicJFKV<_t_backend>& kv, const std::string& key, std::string& value);
+
+/**
+ * Stages a put of key, applied by jfkvcommit.
+ */
+template<typename _t_backend>
+void jfkvput(BasicJFKV<_t_backend>& kv, const std::string& key, const std::string& value);
+
+/**
+ * Stages a delete of key, applied by jfkvcommit. Missing keys are ignored.
+ */
+template<typename _t_backend>
+void jfkvdelete(BasicJFKV<_t_backend>& kv, const std::string& key);
+
+/**
+ * Looks up n keys, setting value and found of every item.
+ * The lookups run in index order, so neighbouring keys share index reads.
+ */
+template<typename _t_backend>
+void jfkvgetbatch(BasicJFKV<_t_backend>& kv, JFKVItem* items, uint64_t n);
+
+/**
+ * Stages a put of every item, applied by jfkvcommit, as n calls to jfkvput would.
+ * If a key appears more than once, the last item wins. found is ignored.
+ * Nothing is written until the commit, so this does not throw a runtime_error.
+ */
+template<typename _t_backend>
+void jfkvputbatch(BasicJFKV<_t_backend>& kv, const JFKVItem* items, uint64_t n);
+
+/**
+ * Stages a delete of n keys, applied by jfkvcommit, as n calls to jfkvdelete would.
+ * Missing keys are ignored, repeated keys are deleted once, and any staged put of a key is dropped.
+ * Nothing is written until the commit, so this does not throw a runtime_error.
+ */
+template<typename _t_backend>
+void jfkvdeletebatch(BasicJFKV<_t_backend>& kv, const std::string* keys, uint64_t n);
+
+/**
+ * Writes every staged change, atomically.
+ * If the commit fails, nothing is written and the changes stay staged.
+ */
+template<typename _t_backend>
+void jfkvcommit(BasicJFKV<_t_backend>& kv);
+
+/**
+ * Drops the staged changes.
+ */
+template<typename _t_backend>
+void jfkvrollback(BasicJFKV<_t_backend>& kv);
+
+/**
+ * Number of keys, as of the last commit.
+ */
+template<typename _t_backend>
+int64_t jfkvsize(const BasicJFKV<_t_backend>& kv);
+
+/**
+ * Closes the store. Staged changes are dropped.
+ */
+template<typename _t_backend>
+void jfkvclose(BasicJFKV<_t_backend>& kv);
+
+}
@@ -0,0 +1,158 @@
+#include "jfpool.h"
+
+#include <stdexcept>
+#include "jfio.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace jfio {
+
+template<typename _t_backend>
+static inline bool isIdle(const BasicJFile<_t_backend>& file) {
+  return file.journalEndPos == 0 && file.currentBlockLength == 0;
+}
+
+/**
+ * Closes the least recently used idle file.
+ */
+template<typename _t_backend>
+static inline void evictOne(BasicJFPool<_t_backend>& pool) {
+  for (auto it = pool.lru.rbegin(); it != pool.lru.rend(); ++it) {
+    auto& entry = pool.entries.at(*it);
+    if (!isIdle(entry.file)) {
+      continue;
+    }
+
+    jfclose(entry.file);
+    entry.open = false;
+    pool.lru.erase(next(it).base());
+    pool.evictions++;
+    return;
+  }
+
+  throw runtime_error("jfpoolget: every pooled file has uncommitted writes");
+}
+
+/**
+ * Opens the file of entry, restoring what jfopen does not know about.
+ */
+template<typename _t_backend>
+static inline void reopen(BasicJFPool<_t_backend>& pool, JFPoolEntry<_t_backend>& entry, const string& key) {
+  while (pool.lru.size() >= pool.maxOpen) {
+    evictOne(pool);
+  }
+
+  // Never truncate a file that was opened before
+  const auto readOnly = entry.modeA[0] == 'r' && entry.modeA.find('+') == string::npos;
+  const string mode = readOnly ? "rb" : "rb+";
+
+  auto file = jfopen<_t_backend>(entry.file.path, entry.journalPath, mode, mode, entry.shareMode);
+  file.pos = entry.file.pos;
+  // jfclear goes back to the last committed position. The committed end of file
+  // (lastPersistedMaxPos) is the file size jfopen just read.
+  file.lastPersistedPos = entry.file.lastPersistedPos;
+  file.deltaMode = entry.file.deltaMode;
+  file.codec = entry.file.codec;
+  file.stats = entry.file.stats;
+
+  entry.file = move(file);
+  entry.open = true;
+  pool.lru.push_front(key);
+  entry.lru = pool.lru.begin();
+  pool.opens++;
+}
+
+template<typename _t_backend>
+BasicJFPool<_t_backend> jfpoolopen(size_t maxOpen) {
+  if (maxOpen < 1) {
+    throw runtime_error("jfpoolopen: the pool must hold at least 1 file");
+  }
+
+  BasicJFPool<_t_backend> pool;
+  pool.maxOpen = maxOpen;
+  return pool;
+}
+
+template<typename _t_backend>
+BasicJFile<_t_backend>& jfpoolget(
+  BasicJFPool<_t_backend>& pool,
+  const fs::path& mainFilePath,
+  const fs::path& journalFilePath,
+  const string& mainFileModeA,
+  const string& mainFileModeB,
+  int shareMode
+) {
+  const auto& key = mainFilePath.string();
+
+  auto it = pool.entries.find(key);
+  if (it != pool.entries.end()) {
+    auto& entry = it->second;
+    if (entry.open) {
+      pool.lru.splice(pool.lru.begin(), pool.lru, entry.lru);
+    } else {
+      reopen(pool, entry, key);
+    }
+
+    return entry.file;
+  }
+
+  while (pool.lru.size() >= pool.maxOpen) {
+    evictOne(pool);
+  }
+
+  JFPoolEntry<_t_backend> entry;
+  entry.file = jfopen<_t_backend>(mainFilePath, journalFilePath, mainFileModeA, mainFileModeB, shareMode);
+  entry.journalPath = journalFilePath;
+  entry.modeA = mainFileModeA;
+  entry.modeB = mainFileModeB;
+  entry.shareMode = shareMode;
+  entry.open = true;
+  pool.opens++;
+
+  pool.lru.push_front(key);
+  entry.lru = pool.lru.begin();
+
+  return pool.entries.emplace(key, move(entry)).first->second.file;
+}
+
+template<typename _t_backend>
+void jfpoolremove(BasicJFPool<_t_backend>& pool, const fs::path& mainFilePath) {
+  auto it = pool.entries.find(mainFilePath.string());
+  if (it == pool.entries.end()) {
+    return;
+  }
+
+  if (it->second.open) {
+    jfclose(it->second.file);
+    pool.lru.erase(it->second.lru);
+  }
+
+  pool.entries.erase(it);
+}
+
+template<typename _t_backend>
+void jfpoolclose(BasicJFPool<_t_backend>& pool) {
+  for (auto& item : pool.entries) {
+    if (item.second.open) {
+      jfclose(item.second.file);
+    }
+  }
+
+  pool.entries.clear();
+  pool.lru.clear();
+}
+
+#define JFPOOL_INSTANTIATE(B) \
+  template BasicJFPool<B> jfpoolopen(size_t); \
+  template BasicJFile<B>& jfpoolget(BasicJFPool<B>&, const fs::path&, const fs::path&, const string&, const string&, int); \
+  template void jfpoolremove(BasicJFPool<B>&, const fs::path&); \
+  template void jfpoolclose(BasicJFPool<B>&);
+
+JFPOOL_INSTANTIATE(StdioBackend)
+JFPOOL_INSTANTIATE(MemoryBackend)
+#ifndef WIN32
+JFPOOL_INSTANTIATE(FdBackend)
+#endif
+
+}
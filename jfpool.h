@@ -0,0 +1,92 @@
+#pragma once
+
+#include <filesystem>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "jfile.h"
+
+namespace jfio {
+
+constexpr size_t kDefaultPoolMaxOpen = 256;
+
+/**
+ * A file of the pool, with what it takes to open it again.
+ * The file keeps its fields (position, delta mode, codec, stats) while closed.
+ */
+template<typename _t_backend>
+struct JFPoolEntry {
+  BasicJFile<_t_backend> file;
+  std::filesystem::path journalPath;
+  std::string modeA;
+  std::string modeB;
+  int shareMode = 0;
+
+  bool open = false;
+
+  // Position in the pool's list of open files, while open.
+  std::list<std::string>::iterator lru;
+};
+
+/**
+ * Keeps at most maxOpen files open, keyed by main file path.
+ * When the limit is reached, the least recently used file that has no
+ * uncommitted writes is closed. It is opened again, at the same position,
+ * the next time it is asked for.
+ * Like the files themselves, a pool is not thread safe.
+ */
+template<typename _t_backend>
+struct BasicJFPool {
+  size_t maxOpen = kDefaultPoolMaxOpen;
+
+  std::unordered_map<std::string, JFPoolEntry<_t_backend>> entries;
+
+  // Main file paths of the open entries, most recently used first.
+  std::list<std::string> lru;
+
+  // Calls to jfopen, and how many files were closed to make room.
+  uint64_t opens = 0;
+  uint64_t evictions = 0;
+};
+
+using JFPool = BasicJFPool<StdioBackend>;
+
+/**
+ * Creates a pool keeping at most maxOpen files open (at least 1).
+ */
+template<typename _t_backend = StdioBackend>
+BasicJFPool<_t_backend> jfpoolopen(size_t maxOpen = kDefaultPoolMaxOpen);
+
+/**
+ * Returns the pooled file for mainFilePath, opening it (see jfopen) if needed.
+ * The modes and share mode only apply the first time. Files closed by the pool
+ * are opened again without truncating ("rb+", or "rb" for read-only modes),
+ * with their position restored.
+ * The returned file may be closed by any later jfpoolget call,
+ * so call jfpoolget again instead of keeping it around.
+ * Throws a runtime_error if the pool is full of files with uncommitted writes.
+ */
+template<typename _t_backend>
+BasicJFile<_t_backend>& jfpoolget(
+  BasicJFPool<_t_backend>& pool,
+  const std::filesystem::path& mainFilePath,
+  const std::filesystem::path& journalFilePath,
+  const std::string& mainFileModeA,
+  const std::string& mainFileModeB,
+  int shareMode = SHARE_MODE_WRITING_SHARE_READ
+);
+
+/**
+ * Closes the file of mainFilePath if it is open, and forgets it.
+ * Uncommitted writes are not flushed.
+ */
+template<typename _t_backend>
+void jfpoolremove(BasicJFPool<_t_backend>& pool, const std::filesystem::path& mainFilePath);
+
+/**
+ * Closes every file of the pool and forgets them.
+ */
+template<typename _t_backend>
+void jfpoolclose(BasicJFPool<_t_backend>& pool);
+
+}
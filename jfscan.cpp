@@ -0,0 +1,173 @@
+#include "jfscan.h"
+
+#include <stdexcept>
+#include "jfio.h"
+
+using namespace std;
+
+namespace jfio {
+
+template<typename _t_backend>
+static void scanWorker(JFScanState<_t_backend>& state) {
+  unique_lock<mutex> lock(state.mutex);
+
+  while (true) {
+    state.cv.wait(lock, [&] {
+      const auto capacity = state.chunks.size() - (state.held ? 1 : 0);
+      return state.stop || (!state.eof && !state.error && state.filled < capacity);
+    });
+
+    if (state.stop) {
+      return;
+    }
+
+    auto& chunk = state.chunks[(state.head + state.filled) % state.chunks.size()];
+    const auto pos = state.readPos;
+    const auto generation = state.generation;
+    lock.unlock();
+
+    uint64_t length = 0;
+    exception_ptr error;
+    try {
+      length = readMainFile(*state.file, pos, chunk.data.data(), state.chunkSize);
+    } catch (...) {
+      error = current_exception();
+    }
+
+    lock.lock();
+    if (generation != state.generation) {
+      // A seek happened while reading, this chunk is stale
+      continue;
+    }
+
+    if (error) {
+      state.error = error;
+    } else if (length == 0) {
+      state.eof = true;
+    } else {
+      chunk.pos = pos;
+      chunk.length = length;
+      state.filled++;
+      state.readPos += length;
+      state.eof = length < state.chunkSize;
+    }
+
+    state.cv.notify_all();
+  }
+}
+
+template<typename _t_backend>
+BasicJFScan<_t_backend> jfscanopen(BasicJFile<_t_backend>& file, uint64_t chunkSize, int numChunks) {
+  if (file.journalEndPos != 0 || file.currentBlockLength != 0) {
+    throw runtime_error("jfscanopen: cannot scan during writing mode");
+  }
+
+  if (chunkSize == 0 || numChunks < 2) {
+    throw runtime_error("jfscanopen: need at least 2 chunks of at least 1 byte");
+  }
+
+  BasicJFScan<_t_backend> scan;
+  scan.state.reset(new JFScanState<_t_backend>());
+
+  auto& state = *scan.state;
+  state.file = &file;
+  state.chunkSize = chunkSize;
+  state.chunks.resize(numChunks);
+  for (auto& chunk : state.chunks) {
+    chunk.data.resize(chunkSize);
+  }
+
+  state.readPos = file.pos;
+
+  // Get the kernel started on the whole window. From there on, its own
+  // sequential readahead keeps ahead of the worker's large reads.
+  file.f.readahead(file.pos, chunkSize * numChunks);
+  state.worker = thread(scanWorker<_t_backend>, ref(state));
+
+  return scan;
+}
+
+template<typename _t_backend>
+bool jfscannext(BasicJFScan<_t_backend>& scan, const unsigned char*& data, uint64_t& length) {
+  if (!scan.state) {
+    throw runtime_error("jfscannext: scan is closed");
+  }
+
+  auto& state = *scan.state;
+  unique_lock<mutex> lock(state.mutex);
+
+  if (state.held) {
+    // The consumer is done with the previous chunk, it can be refilled
+    state.held = false;
+    state.cv.notify_all();
+  }
+
+  state.cv.wait(lock, [&] {
+    return state.filled > 0 || state.eof || state.error;
+  });
+
+  if (state.filled == 0) {
+    if (state.error) {
+      rethrow_exception(state.error);
+    }
+
+    return false;
+  }
+
+  const auto& chunk = state.chunks[state.head];
+  state.head = (state.head + 1) % state.chunks.size();
+  state.filled--;
+  state.held = true;
+
+  data = chunk.data.data();
+  length = chunk.length;
+  state.file->pos = chunk.pos + chunk.length;
+
+  return true;
+}
+
+template<typename _t_backend>
+void jfscanseek(BasicJFScan<_t_backend>& scan, int64_t pos) {
+  if (!scan.state) {
+    throw runtime_error("jfscanseek: scan is closed");
+  }
+
+  if (pos < 0) {
+    throw runtime_error("Cannot seek to before zero");
+  }
+
+  auto& state = *scan.state;
+  lock_guard<mutex> lock(state.mutex);
+
+  state.generation++;
+  state.filled = 0;
+  state.held = false;
+  state.eof = false;
+  state.error = nullptr;
+  state.readPos = pos;
+  state.file->pos = pos;
+  state.cv.notify_all();
+
+  // A seek breaks the kernel's sequential pattern detection
+  state.file->f.readahead(pos, state.chunkSize * state.chunks.size());
+}
+
+template<typename _t_backend>
+void jfscanclose(BasicJFScan<_t_backend>& scan) {
+  // The state destructor stops and joins the readahead thread
+  scan.state.reset();
+}
+
+#define JFSCAN_INSTANTIATE(B) \
+  template BasicJFScan<B> jfscanopen(BasicJFile<B>&, uint64_t, int); \
+  template bool jfscannext(BasicJFScan<B>&, const unsigned char*&, uint64_t&); \
+  template void jfscanseek(BasicJFScan<B>&, int64_t); \
+  template void jfscanclose(BasicJFScan<B>&);
+
+JFSCAN_INSTANTIATE(StdioBackend)
+JFSCAN_INSTANTIATE(MemoryBackend)
+#ifndef WIN32
+JFSCAN_INSTANTIATE(FdBackend)
+#endif
+
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "jfile.h"
+
+namespace jfio {
+
+constexpr uint64_t kDefaultScanChunkBytes = 1024 * 1024;
+constexpr int kDefaultScanChunks = 3;
+
+struct JFScanChunk {
+  std::vector<unsigned char> data;
+  int64_t pos = 0;
+  uint64_t length = 0;
+};
+
+/**
+ * Shared between the consumer and the readahead thread.
+ * Chunks form a ring: [head, head + filled) are ready to be consumed,
+ * and the chunk before head is the one the consumer is looking at (if held).
+ */
+template<typename _t_backend>
+struct JFScanState {
+  BasicJFile<_t_backend>* file = nullptr;
+  uint64_t chunkSize = 0;
+  std::vector<JFScanChunk> chunks;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  size_t head = 0;
+  size_t filled = 0;
+  bool held = false;
+
+  // Next position the readahead thread reads from.
+  int64_t readPos = 0;
+
+  // Bumped by every seek, so reads that were in flight are dropped.
+  uint64_t generation = 0;
+
+  bool eof = false;
+  bool stop = false;
+  std::exception_ptr error;
+
+  std::thread worker;
+
+  ~JFScanState() {
+    if (worker.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+
+      cv.notify_all();
+      worker.join();
+    }
+  }
+};
+
+/**
+ * A sequential scan over a read-mode file.
+ * A background thread reads large chunks ahead of the consumer.
+ * The file must not be used by anything else until jfscanclose.
+ */
+template<typename _t_backend>
+struct BasicJFScan {
+  std::unique_ptr<JFScanState<_t_backend>> state;
+};
+
+using JFScan = BasicJFScan<StdioBackend>;
+
+/**
+ * Starts scanning the file from jftell() position.
+ * numChunks buffers of chunkSize bytes are filled ahead of the consumer
+ * (at least 2, so one can be read while the next one is filled).
+ * Throws a runtime_error if the file is in writing mode.
+ */
+template<typename _t_backend>
+BasicJFScan<_t_backend> jfscanopen(
+  BasicJFile<_t_backend>& file,
+  uint64_t chunkSize = kDefaultScanChunkBytes,
+  int numChunks = kDefaultScanChunks
+);
+
+/**
+ * Moves to the next chunk of the file, waiting for it to be read if needed.
+ * data/length point into the scan's own buffer (no copy), and stay valid
+ * until the next jfscannext, jfscanseek or jfscanclose call.
+ * jftell() of the file is moved past the returned chunk.
+ * Returns false at the end of the file.
+ */
+template<typename _t_backend>
+bool jfscannext(BasicJFScan<_t_backend>& scan, const unsigned char*& data, uint64_t& length);
+
+/**
+ * Restarts the scan at pos. Chunks read ahead so far are dropped.
+ */
+template<typename _t_backend>
+void jfscanseek(BasicJFScan<_t_backend>& scan, int64_t pos);
+
+/**
+ * Stops the readahead thread. Can be called before reaching the end of the file.
+ */
+template<typename _t_backend>
+void jfscanclose(BasicJFScan<_t_backend>& scan);
+
+}
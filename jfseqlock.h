@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+#include "file2.h"
+
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+namespace jfio {
+
+// A commit counter shared by every process that opens the same file.
+// The writer makes the sequence odd while replaying a commit into the
+// main file and even again once it is done (a seqlock), together with
+// the committed length. Readers check the sequence around each read,
+// so they never return a half-replayed commit and never take a lock.
+//
+// The state lives in a tiny file next to the journal, mapped into every process.
+// It is only available on POSIX systems, and only for backends whose files
+// other processes can see.
+
+struct JFSharedState {
+  // Even: idle, odd: a commit is being replayed. 0 if no writer ever published.
+  std::atomic<uint64_t> sequence;
+
+  // Main file length as of the last commit.
+  std::atomic<int64_t> committedLength;
+};
+
+// Readers spinning this often on an odd sequence check that the writer is still alive.
+constexpr int kSeqLockSpinsBeforeCheck = 1000;
+
+struct JFSeqLock {
+  JFSharedState* shared = nullptr;
+  int fd = -1;
+
+  /**
+   * Maps the shared state stored at path, creating it if needed.
+   * Writers lock the file, so readers can tell whether a
+   * commit in progress still has a process behind it.
+   * Returns a closed lock if the file cannot be opened by a reader.
+   */
+  static JFSeqLock open(const std::filesystem::path& path, bool writer) {
+    JFSeqLock lock;
+
+    #ifndef WIN32
+    const auto& pathStr = path.string();
+
+    bool readOnly = false;
+    lock.fd = ::open(pathStr.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (lock.fd < 0 && !writer) {
+      // Readers may not be allowed to write next to the file
+      lock.fd = ::open(pathStr.c_str(), O_RDONLY | O_CLOEXEC);
+      readOnly = true;
+    }
+
+    if (lock.fd < 0) {
+      if (writer) {
+        throw std::runtime_error("Cannot open file " + pathStr);
+      }
+
+      return lock;
+    }
+
+    struct stat st;
+    if (fstat(lock.fd, &st) != 0 ||
+      (st.st_size < int64_t(sizeof(JFSharedState)) &&
+        (readOnly || ftruncate(lock.fd, sizeof(JFSharedState)) != 0))) {
+      lock.close();
+      if (writer) {
+        throw std::runtime_error("Cannot initialize " + pathStr);
+      }
+
+      return lock;
+    }
+
+    const auto prot = readOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+    void* address = mmap(nullptr, sizeof(JFSharedState), prot, MAP_SHARED, lock.fd, 0);
+    if (address == MAP_FAILED) {
+      lock.close();
+      if (writer) {
+        throw std::runtime_error("Cannot map " + pathStr);
+      }
+
+      return lock;
+    }
+
+    lock.shared = static_cast<JFSharedState*>(address);
+
+    if (writer) {
+      // The journal lock already guarantees a single writer
+      fdlockrange(lock.fd, F_WRLCK, 0, 1);
+
+      // A writer that crashed in the middle of a commit left the sequence odd
+      auto sequence = lock.shared->sequence.load();
+      if ((sequence & 1) != 0) {
+        lock.shared->sequence.store(sequence + 1);
+      }
+    }
+    #endif
+
+    return lock;
+  }
+
+  /**
+   * Reads the shared state stored at path without mapping it, which is
+   * much cheaper when the state only needs to be checked.
+   * Returns false if there is no state yet.
+   */
+  static bool peek(const std::filesystem::path& path, uint64_t& sequence, int64_t& committedLength) {
+    #ifndef WIN32
+    const int fd = ::open(path.string().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+
+    uint64_t state[2];
+    const auto bytesRead = pread(fd, state, sizeof(state), 0);
+    ::close(fd);
+
+    if (bytesRead != sizeof(state)) {
+      return false;
+    }
+
+    sequence = state[0];
+    committedLength = int64_t(state[1]);
+    return true;
+    #else
+    return false;
+    #endif
+  }
+
+  bool isOpen() const {
+    return shared != nullptr;
+  }
+
+  void close() {
+    #ifndef WIN32
+    if (shared) {
+      munmap(shared, sizeof(JFSharedState));
+      shared = nullptr;
+    }
+
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+    #endif
+  }
+
+  /**
+   * Marks the start of a commit. Readers wait until publish().
+   */
+  void beginCommit() {
+    shared->sequence.fetch_add(1);
+  }
+
+  /**
+   * Publishes the new committed length and ends the commit.
+   */
+  void publish(int64_t committedLength) {
+    shared->committedLength.store(committedLength);
+    shared->sequence.fetch_add(1);
+  }
+
+  /**
+   * Returns an even sequence, waiting for a commit in progress to finish.
+   * Throws if the writer died in the middle of a commit: the main file
+   * is not consistent until it is opened for writing again.
+   */
+  uint64_t readBegin() const {
+    for (int spins = 1; ; spins++) {
+      const auto sequence = shared->sequence.load();
+      if ((sequence & 1) == 0) {
+        return sequence;
+      }
+
+      if (spins % kSeqLockSpinsBeforeCheck == 0 && !writerAlive()) {
+        throw std::runtime_error("An interrupted commit must be recovered by opening the file for writing");
+      }
+
+      std::this_thread::yield();
+    }
+  }
+
+  /**
+   * Returns true if no commit started since readBegin returned sequence.
+   */
+  bool readValidate(uint64_t sequence) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return shared->sequence.load(std::memory_order_relaxed) == sequence;
+  }
+
+  /**
+   * Number of commits published so far.
+   */
+  uint64_t commits() const {
+    return shared->sequence.load() / 2;
+  }
+
+  int64_t committedLength() const {
+    return shared->committedLength.load();
+  }
+
+private:
+  bool writerAlive() const {
+    #ifndef WIN32
+    return fdislocked(fd, F_WRLCK, 0, 1);
+    #else
+    return false;
+    #endif
+  }
+};
+
+/**
+ * Reads committed bytes of the main file while another process may be committing.
+ * The read is retried if a commit ran in the meantime, and the backend's cached
+ * data is dropped whenever a new commit is seen (seenSequence tracks the last one).
+ * Bytes past the committed length (e.g. appends of an open session) are never returned.
+ */
+template<typename _t_backend>
+static inline uint64_t seqlockRead(
+  const JFSeqLock& lock,
+  uint64_t& seenSequence,
+  _t_backend& f,
+  int64_t pos,
+  void* buff,
+  uint64_t n
+) {
+  while (true) {
+    const auto sequence = lock.readBegin();
+    if (sequence != seenSequence) {
+      f.discardCache();
+      seenSequence = sequence;
+    }
+
+    auto bounded = n;
+    if (sequence != 0) {
+      const auto length = lock.committedLength();
+      bounded = pos >= length ? 0 : std::min<uint64_t>(n, uint64_t(length - pos));
+    }
+
+    const auto bytesRead = bounded == 0 ? 0 : f.read(pos, buff, bounded);
+    if (lock.readValidate(sequence)) {
+      return bytesRead;
+    }
+  }
+}
+
+}
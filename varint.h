@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+namespace jfio {
+
+// Variable length integers (LEB128): 7 bits per byte, least significant
+// group first, high bit set on every byte except the last.
+// Signed values are zigzag encoded first, so small negative numbers stay short.
+
+constexpr int kMaxVarintBytes = 10;
+
+static inline uint64_t zigzagEncode(int64_t value) {
+  return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+static inline int64_t zigzagDecode(uint64_t value) {
+  return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+/**
+ * Encodes value into buff (which must hold kMaxVarintBytes).
+ * Returns the number of bytes written.
+ */
+static inline int encodeVarint(uint64_t value, unsigned char* buff) {
+  int n = 0;
+  while (value >= 0x80) {
+    buff[n++] = static_cast<unsigned char>(value | 0x80);
+    value >>= 7;
+  }
+
+  buff[n++] = static_cast<unsigned char>(value);
+  return n;
+}
+
+/**
+ * Returns the number of bytes encodeVarint would write.
+ */
+static inline int varintSize(uint64_t value) {
+  int n = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    n++;
+  }
+
+  return n;
+}
+
+/**
+ * Decodes one varint from at most n bytes.
+ * Returns the number of bytes consumed, or 0 if the varint is incomplete.
+ * Throws if the varint is longer than kMaxVarintBytes.
+ */
+static inline int decodeVarint(const unsigned char* buff, uint64_t n, uint64_t& value) {
+  uint64_t result = 0;
+  int shift = 0;
+
+  for (int i = 0; i < kMaxVarintBytes; i++) {
+    if (uint64_t(i) >= n) {
+      return 0;
+    }
+
+    result |= uint64_t(buff[i] & 0x7F) << shift;
+    if ((buff[i] & 0x80) == 0) {
+      value = result;
+      return i + 1;
+    }
+
+    shift += 7;
+  }
+
+  throw std::runtime_error("Invalid varint");
+}
+
+static inline uint64_t loadLittleEndian64(const unsigned char* buff) {
+  uint64_t word = 0;
+  #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  for (int i = 7; i >= 0; i--) {
+    word = (word << 8) | buff[i];
+  }
+  #else
+  std::memcpy(&word, buff, 8);
+  #endif
+  return word;
+}
+
+static inline int countTrailingZeros64(uint64_t x) {
+  #if defined(_MSC_VER)
+  unsigned long index = 0;
+  _BitScanForward64(&index, x);
+  return int(index);
+  #else
+  return __builtin_ctzll(x);
+  #endif
+}
+
+/**
+ * Decodes consecutive varints from buff into out, stopping after maxCount
+ * values or at the first incomplete varint at the end of the buffer.
+ * consumed is set to the number of bytes used, so a streaming caller
+ * can carry the remaining bytes over to the next jfgetn buffer.
+ * Returns the number of values decoded.
+ *
+ * Varints are decoded 8 bytes at a time: one 64 bit load yields the terminating
+ * bytes of every varint in the word as a bit mask, and each value's 7 bit groups
+ * are packed with pext (BMI2) or three shift/mask steps, with no per-byte loop.
+ * Only varints longer than 8 bytes (values of 2^56 and up) take the scalar path.
+ */
+static inline uint64_t decodeVarints(
+  const unsigned char* buff,
+  uint64_t n,
+  uint64_t* out,
+  uint64_t maxCount,
+  uint64_t& consumed
+) {
+  uint64_t pos = 0;
+  uint64_t count = 0;
+
+  while (count < maxCount) {
+    if (n - pos >= 8) {
+      const auto word = loadLittleEndian64(buff + pos);
+      auto stops = ~word & 0x8080808080808080ULL;
+
+      if (stops != 0) {
+        // Every varint that ends inside this word is decoded from the register,
+        // so the next value does not wait for another load.
+        int usedBits = 0;
+        while (stops != 0 && count < maxCount) {
+          const int endBit = countTrailingZeros64(stops) + 1;
+          const int bits = endBit - usedBits;
+          auto x = (word >> usedBits) & (bits == 64 ? ~0ULL : (1ULL << bits) - 1);
+
+          #if defined(__BMI2__)
+          x = _pext_u64(x, 0x7F7F7F7F7F7F7F7FULL);
+          #else
+          x &= 0x7F7F7F7F7F7F7F7FULL;
+          x = ((x & 0x7F007F007F007F00ULL) >> 1) | (x & 0x007F007F007F007FULL);
+          x = ((x & 0x3FFF00003FFF0000ULL) >> 2) | (x & 0x00003FFF00003FFFULL);
+          x = ((x & 0x0FFFFFFF00000000ULL) >> 4) | (x & 0x000000000FFFFFFFULL);
+          #endif
+
+          out[count++] = x;
+          usedBits = endBit;
+          stops &= stops - 1;
+        }
+
+        pos += usedBits / 8;
+        continue;
+      }
+    }
+
+    // Near the end of the buffer, or a 9-10 byte varint
+    uint64_t value = 0;
+    const auto used = decodeVarint(buff + pos, n - pos, value);
+    if (used == 0) {
+      break;
+    }
+
+    out[count++] = value;
+    pos += used;
+  }
+
+  consumed = pos;
+  return count;
+}
+
+/**
+ * Reads the length-prefixed record starting at buff[pos] without copying it.
+ * On success, data/length point into buff, pos moves past the record
+ * and true is returned. Returns false (pos unchanged) if the record is
+ * incomplete.
+ */
+static inline bool nextRecord(
+  const unsigned char* buff,
+  uint64_t n,
+  uint64_t& pos,
+  const unsigned char*& data,
+  uint64_t& length
+) {
+  uint64_t recordLength = 0;
+  const auto used = decodeVarint(buff + pos, n - pos, recordLength);
+  if (used == 0 || recordLength > n - pos - used) {
+    return false;
+  }
+
+  data = buff + pos + used;
+  length = recordLength;
+  pos += used + recordLength;
+  return true;
+}
+
+}